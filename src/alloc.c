@@ -1,332 +1,2127 @@
+#define _GNU_SOURCE // mremap
+
 #include "alloc.h"
+#include "buddy.h"
+#include "numa.h"
+#include "radix.h"
+#include "region.h"
+#include "slab.h"
+#include "trace.h"
+#include "tree.h"
 
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 
 #define ALIGNMENT 16 /**< The alignment of the memory blocks */
+#define MAGIC 0x01234567 /**< Magic number stored in every allocated header */
+#define TCACHE_COOKIE 0x5bd1e9955bd1e995ULL /**< Mixed with the cache address to tag cached blocks */
+
+#define SMALL_CLASSES 32 /**< Number of exact size classes, ALIGNMENT bytes apart */
+#define SMALL_MAX (SMALL_CLASSES * ALIGNMENT) /**< Largest size served by an exact class */
+
+#ifdef TU_POLICY_TLSF
+#define SL_LOG2 4 /**< log2 of the number of second-level lists per power of two */
+#define SL_COUNT (1 << SL_LOG2) /**< Second-level lists per power of two */
+#define FL_SHIFT (SL_LOG2 + 4) /**< Sizes below 1 << FL_SHIFT are split into ALIGNMENT steps */
+#define FL_MAX_LOG2 40 /**< Blocks must be smaller than 1 << FL_MAX_LOG2 */
+#define FL_COUNT (FL_MAX_LOG2 - FL_SHIFT + 1) /**< Number of first-level rows */
+#define NUM_BINS (FL_COUNT * SL_COUNT) /**< Total number of segregated free lists */
+#else
+#define NUM_BINS 64 /**< Total number of segregated free lists */
+#endif
+
+#if defined(TU_POLICY_BESTFIT) || defined(TU_POLICY_GOODFIT) || defined(TU_POLICY_ADDRFIT)
+#define TU_POLICY_TREE /**< Blocks above SMALL_MAX are kept in a tree (see tree.h for its order) */
+#endif
+
+#ifdef TU_POLICY_GOODFIT
+#define FIT_SLACK(size) ((size) / 8) /**< Waste a good fit takes without searching on */
+#else
+#define FIT_SLACK(size) 0 /**< Best fit always searches for the smallest block */
+#endif
+
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128 * 1024) /**< Requests of at least this many bytes get their own mapping */
+#endif
+
+#ifndef REGION_SIZE
+#define REGION_SIZE ((size_t)64 << 30) /**< Address space reserved for the heap */
+#endif
+
+#define CHUNK_MIN (1024 * 1024) /**< First heap growth of an arena */
+#define CHUNK_MAX (16 * 1024 * 1024) /**< Largest heap growth; chunks double up to this */
+
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (4 * 1024 * 1024) /**< A free top block this large is given back to the OS */
+#endif
+#define TRIM_PAD CHUNK_MIN /**< Bytes an automatic trim leaves at the top, so churn does not map and unmap */
+
+#ifndef DECAY_MS
+#define DECAY_MS 10000 /**< Free pages stay resident at least this long before they are purged; 0 never purges */
+#endif
+#define PURGE_MIN (2 * 4096) /**< Free blocks this large are stamped and may cover a whole page */
+#define PURGED (~0UL) /**< Stamp of a free block whose interior pages have been purged */
+
+#define MAINTENANCE_INTERVAL_MS 100 /**< Default period of the maintenance thread */
+#define MAINTENANCE_RESERVE CHUNK_MIN /**< Default free heap the maintenance thread keeps per arena */
+
+#define ARENAS_PER_CPU 4 /**< Default number of arenas per online CPU */
+#define MAX_ARENAS 64 /**< Upper bound on the number of arenas */
+
+#define TCACHE_MAX 64 /**< Most blocks a thread caches per size class */
+#define TCACHE_BATCH 32 /**< Blocks moved between a thread cache and the heap at once */
+
+_Static_assert(SLAB_CLASSES == SMALL_CLASSES, "every exact class needs a slab list");
+_Static_assert(MAX_ARENAS >= NUMA_MAX_NODES, "every NUMA node needs an arena");
+#ifdef TU_POLICY_TLSF
+_Static_assert((1 << FL_SHIFT) / SL_COUNT == ALIGNMENT, "the first row must step by ALIGNMENT");
+_Static_assert(REGION_SIZE < ((size_t)1 << FL_MAX_LOG2), "every heap block must map to a row");
+#endif
+
+#define ALIGN_UP(n) (((n) + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1))
+#define MAX_REQUEST ((size_t)PTRDIFF_MAX) /**< Larger requests fail like in glibc; smaller ones cannot wrap in ALIGN_UP */
+#define BLOCK_SIZE(b) ((b)->size & ~(size_t)BLOCK_FLAGS) /**< Size of a block without its flags */
+
+/**
+ * An independent heap with its own lock. Threads are spread over the arenas
+ * so that threads allocating heavily do not contend on one lock.
+ */
+typedef struct arena {
+    pthread_mutex_t lock; /**< Protects everything below */
+    unsigned int index; /**< Position in arenas[], stored in block headers */
+    unsigned int node; /**< NUMA node the arena's memory is placed on, an index below tu_numa_node_count() */
+
+#ifdef TU_POLICY_TLSF
+    /**
+     * Two-level segregated free lists. Row f of SL_COUNT lists splits the
+     * sizes [2^(f + FL_SHIFT - 1), 2^(f + FL_SHIFT)) into equal steps; row 0
+     * holds everything below 1 << FL_SHIFT in ALIGNMENT steps.
+     */
+    free_block *bins[NUM_BINS];
+    unsigned long long fl_map; /**< Bit f is set when row f has a non-empty list */
+    unsigned int sl_map[FL_COUNT]; /**< Bit s of entry f is set when bins[f * SL_COUNT + s] is not empty */
+#else
+    /**
+     * Segregated free lists. Bins [0, SMALL_CLASSES) hold blocks of exactly
+     * (i + 1) * ALIGNMENT bytes, the remaining bins hold power-of-two ranges
+     * and the last bin holds everything that does not fit anywhere else.
+     */
+    free_block *bins[NUM_BINS];
+    unsigned long long bin_map; /**< Bit i is set when bins[i] is not empty */
+#endif
+#ifdef TU_POLICY_TREE
+    tree_node *fit_tree; /**< Free blocks above SMALL_MAX, instead of the range bins */
+#endif
+    size_t heap_bytes; /**< Bytes taken from the heap region */
+    size_t free_bytes; /**< Bytes in free blocks, headers included */
+
+    /**
+     * Decay purging: free blocks of at least PURGE_MIN bytes are stamped
+     * with purge_epoch when they are binned, and a sweep every DECAY_MS
+     * purges the ones stamped before the previous sweep
+     */
+    unsigned long purge_epoch;
+    unsigned long last_sweep; /**< Time of the last sweep, in milliseconds */
+
+    /**
+     * End of the arena's newest segment, just past its epilogue header. The
+     * epilogue is a zero sized block that is never freed, so every real block
+     * has a successor header to carry its BLOCK_PREV_FREE bit and coalescing
+     * never runs into memory of another arena.
+     */
+    char *heap_end;
+    size_t chunk_size; /**< How much the next growth asks for */
+
+    slab_bins slabs; /**< Slabs the exact size classes are carved from */
+    buddy_bins buddy; /**< Power-of-two blocks for mid-size requests (TU_POLICY_BUDDY) */
+} arena;
+
+static arena arenas[MAX_ARENAS];
+static unsigned int arena_count = 0;
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+static unsigned int arena_next[NUMA_MAX_NODES]; /**< Round-robin cursors for binding threads, per node */
+static _Thread_local arena *thread_arena = NULL;
+
+/** Address ranges the arenas grow into, one per node */
+static region heap_regions[NUMA_MAX_NODES] = {
+    [0 ... NUMA_MAX_NODES - 1] = REGION_INITIALIZER(REGION_SIZE, ALIGNMENT)
+};
+
+/** What the radix tree maps heap chunk pages and large mapping pages to */
+static span heap_span = { SPAN_HEAP };
+static span large_span = { SPAN_LARGE };
+
+/**
+ * Link stored in the first 16 bytes of a block sitting in a thread cache.
+ * Heap blocks keep their header, so they still look allocated to their
+ * neighbours. Slab slots have no header at all, so the key is what lets a
+ * second tufree() of a cached block be caught.
+ */
+typedef struct cache_entry {
+    struct cache_entry *next; /**< Next cached block of the same class */
+    uintptr_t key; /**< tcache_key_of() the owning cache while cached */
+} cache_entry;
+
+/**
+ * Per-thread cache of blocks in the exact size classes
+ *
+ * Only the owning thread touches the lists, except that the maintenance
+ * thread may flush a cache that has been idle for a whole period. The two
+ * hand the cache over with in_use and steal (see tcache_enter()).
+ */
+typedef struct tcache {
+    cache_entry *bins[SMALL_CLASSES]; /**< Cached blocks per class */
+    unsigned int count[SMALL_CLASSES]; /**< Number of blocks in each list */
+    int registered; /**< Whether the exit destructor has been armed */
+    int shut_down; /**< Set once the exit destructor has run; later calls bypass the cache */
+
+    int in_use; /**< Set by the owner while it works on the lists */
+    int steal; /**< Set by the maintenance thread while it may flush the lists */
+    unsigned long ops; /**< Bumped by the owner on every operation */
+    unsigned long seen_ops; /**< ops when the maintenance thread last looked */
+    struct tcache *next_cache; /**< Next registered cache */
+    struct tcache *prev_cache; /**< Previous registered cache */
+} tcache;
+
+static _Thread_local tcache thread_cache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+/** Caches of live threads, so the maintenance thread can find idle ones */
+static tcache *tcache_list = NULL;
+static pthread_mutex_t tcache_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The optional maintenance thread started by tu_init(). While it runs,
+ * tufree() leaves purging and trimming to it.
+ */
+static pthread_t maintenance_thread;
+static int maintenance_running = 0;
+static int maintenance_stop = 0;
+static int membarrier_ready = 0; /**< Whether idle thread caches can be flushed */
+static unsigned int maintenance_interval_ms;
+static size_t maintenance_reserve;
+static pthread_mutex_t maintenance_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maintenance_wake = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Report a misuse of the allocator and stop the program
+ *
+ * @param message What went wrong
+ */
+static void report_and_abort(const char *message) {
+    printf("%s\n", message);
+    fflush(stdout);
+    abort();
+}
+
+/**
+ * Map a small size to its exact size class (thread cache and slab list)
+ *
+ * @param size The aligned size, at most SMALL_MAX
+ * @return The index of the class
+ */
+static int size_to_class(size_t size) {
+    return (int)(size / ALIGNMENT) - 1;
+}
+
+#ifdef TU_POLICY_TLSF
+/**
+ * Map a block size to the bin that holds it
+ *
+ * @param size The (aligned) size of the block
+ * @return The index of the bin, row * SL_COUNT + column
+ */
+static int size_to_bin(size_t size) {
+    if (size < (1 << FL_SHIFT)) {
+        return (int)(size / ALIGNMENT);
+    }
+
+    int log2 = 63 - __builtin_clzll(size);
+    int fl = log2 - FL_SHIFT + 1;
+    int sl = (int)(size >> (log2 - SL_LOG2)) ^ SL_COUNT; // drop the leading bit
+    return fl * SL_COUNT + sl;
+}
+
+/**
+ * Mark a bin as holding blocks in both levels of the bitmap
+ *
+ * @param a The arena that owns the bin
+ * @param bin The index of the bin
+ */
+static void bin_set(arena *a, int bin) {
+    a->sl_map[bin / SL_COUNT] |= 1U << (bin % SL_COUNT);
+    a->fl_map |= 1ULL << (bin / SL_COUNT);
+}
+
+/**
+ * Mark a bin as empty, and its row too if it was the row's last list
+ *
+ * @param a The arena that owns the bin
+ * @param bin The index of the bin
+ */
+static void bin_clear(arena *a, int bin) {
+    a->sl_map[bin / SL_COUNT] &= ~(1U << (bin % SL_COUNT));
+    if (a->sl_map[bin / SL_COUNT] == 0) {
+        a->fl_map &= ~(1ULL << (bin / SL_COUNT));
+    }
+}
+#else
+/**
+ * Map a block size to the bin that holds it
+ *
+ * @param size The (aligned) size of the block
+ * @return The index of the bin
+ */
+static int size_to_bin(size_t size) {
+    if (size <= SMALL_MAX) {
+        return size_to_class(size);
+    }
+
+    // floor(log2(size)) - 9 gives 0 for (512, 1024), 1 for [1024, 2048), ...
+    int bin = SMALL_CLASSES + (63 - __builtin_clzll(size)) - 9;
+    return bin < NUM_BINS ? bin : NUM_BINS - 1;
+}
+
+/**
+ * Mark a bin as holding blocks
+ *
+ * @param a The arena that owns the bin
+ * @param bin The index of the bin
+ */
+static void bin_set(arena *a, int bin) {
+    a->bin_map |= 1ULL << bin;
+}
+
+/**
+ * Mark a bin as empty
+ *
+ * @param a The arena that owns the bin
+ * @param bin The index of the bin
+ */
+static void bin_clear(arena *a, int bin) {
+    a->bin_map &= ~(1ULL << bin);
+}
+#endif
+
+#ifdef TU_POLICY_TREE
+/**
+ * Get the tree node stored in the payload of a free block
+ *
+ * @param block The free block
+ * @return The node
+ */
+static tree_node *block_node(free_block *block) {
+    return (tree_node *)((char *)block + sizeof(header));
+}
+
+/**
+ * Get the free block a tree node is stored in
+ *
+ * @param node The node
+ * @return The free block
+ */
+static free_block *node_block(tree_node *node) {
+    return (free_block *)((char *)node - sizeof(header));
+}
+#endif
+
+#ifdef TU_POLICY_TREE
+#define LINKS_MAX sizeof(tree_node) /**< Most payload bytes the links of a free block take */
+#else
+#define LINKS_MAX sizeof(free_block *) /**< Most payload bytes the links of a free block take */
+#endif
+
+/**
+ * Get how many payload bytes the bookkeeping of a free block of a given
+ * size overwrites: its free-list links and, if it is large, its purge stamp
+ *
+ * @param size The size of the free block
+ * @return The number of bytes at the start of the payload
+ */
+static size_t free_links(size_t size) {
+    if (size >= PURGE_MIN) {
+        return LINKS_MAX + sizeof(unsigned long);
+    }
+#ifdef TU_POLICY_TREE
+    if (size > SMALL_MAX) {
+        return sizeof(tree_node);
+    }
+#endif
+    return sizeof(free_block *);
+}
+
+/**
+ * Get the purge stamp of a free block of at least PURGE_MIN bytes
+ *
+ * @param block The free block
+ * @return Where the stamp is stored, right after the links
+ */
+static unsigned long *purge_stamp(free_block *block) {
+    return (unsigned long *)((char *)block + sizeof(header) + LINKS_MAX);
+}
+
+/**
+ * Push a block onto the free list for its size class
+ *
+ * @param a The arena that owns the block
+ * @param block The block to insert
+ */
+static void insert_free_block(arena *a, free_block *block) {
+    a->free_bytes += BLOCK_SIZE(block) + sizeof(header);
+    if (BLOCK_SIZE(block) >= PURGE_MIN) {
+        *purge_stamp(block) = a->purge_epoch;
+    }
+#ifdef TU_POLICY_TREE
+    if (BLOCK_SIZE(block) > SMALL_MAX) {
+        tree_insert(&a->fit_tree, block_node(block), BLOCK_SIZE(block));
+        return;
+    }
+#endif
 
-static free_block *HEAD = NULL; /**< Pointer to the first element of the free list */
-static free_block *last_allocated = NULL;
+    int bin = size_to_bin(BLOCK_SIZE(block));
+    block->prev = NULL;
+    block->next = a->bins[bin];
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+    a->bins[bin] = block;
+    bin_set(a, bin);
+}
+
+/**
+ * Get the block that physically follows a block
+ *
+ * @param block The block to look past
+ * @return The header of the next block (possibly the epilogue)
+ */
+static header *next_block(void *block) {
+    return (header *)((char *)block + sizeof(header) + BLOCK_SIZE((header *)block));
+}
+
+/**
+ * Mark a block as free: set its flag, write its footer and tell its
+ * successor that the previous block is free
+ *
+ * @param block The block to mark
+ */
+static void mark_free(free_block *block) {
+    size_t size = BLOCK_SIZE(block);
+    block->size |= BLOCK_FREE;
+    ((footer *)((char *)block + sizeof(header) + size - sizeof(footer)))->size = size;
+    next_block(block)->size |= BLOCK_PREV_FREE;
+}
+
+/**
+ * Mark a block as allocated and give it a valid header
+ *
+ * @param a The arena that owns the block
+ * @param block The block to mark
+ */
+static void mark_used(arena *a, free_block *block) {
+    header *hdr = (header *)block;
+    hdr->size &= ~(size_t)BLOCK_FREE;
+    hdr->magic = MAGIC;
+    hdr->arena = a->index;
+    next_block(hdr)->size &= ~(size_t)BLOCK_PREV_FREE;
+}
 
 /**
  * Split a free block into two blocks
  *
+ * The leftover block is marked free but not inserted into a bin.
+ *
  * @param block The block to split
  * @param size The size of the first new split block
- * @return A pointer to the first block or NULL if the block cannot be split
+ * @return A pointer to the second (leftover) block or NULL if the block cannot be split
  */
-void *split(free_block *block, int size) {
-    if((block->size < size + sizeof(free_block))) {
+void *split(free_block *block, size_t size) {
+    size_t block_size = BLOCK_SIZE(block);
+    if (block_size < size + sizeof(header) + ALIGNMENT) {
         return NULL;
     }
 
-    void *split_pnt = (char *)block + size + sizeof(free_block);
+    void *split_pnt = (char *)block + size + sizeof(header);
     free_block *new_block = (free_block *) split_pnt;
 
-    new_block->size = block->size - size - sizeof(free_block);
-    new_block->next = block->next;
+    new_block->size = block_size - size - sizeof(header);
+    new_block->next = NULL;
+    new_block->prev = NULL;
+    mark_free(new_block);
 
-    block->size = size;
+    block->size = size | (block->size & BLOCK_FLAGS);
 
-    return block;
+    return new_block;
 }
 
 
-/* for the sake of tracking the last allocated free block for next fit */
-static free_block *last_alloc = NULL; 
-
-
 /**
  * Find the previous neighbor of a block
  *
  * @param block The block to find the previous neighbor of
- * @return A pointer to the previous neighbor or NULL if there is none
+ * @return A pointer to the previous neighbor or NULL if it is not free
  */
 free_block *find_prev(free_block *block) {
-    free_block *curr = HEAD;
-    while(curr != NULL) {
-        char *next = (char *)curr + curr->size + sizeof(free_block);
-        if(next == (char *)block)
-            return curr;
-        curr = curr->next;
+    if (!(block->size & BLOCK_PREV_FREE)) {
+        return NULL;
     }
-    return NULL;
+    footer *tag = (footer *)((char *)block - sizeof(footer));
+    return (free_block *)((char *)block - tag->size - sizeof(header));
 }
 
 /**
  * Find the next neighbor of a block
  *
  * @param block The block to find the next neighbor of
- * @return A pointer to the next neighbor or NULL if there is none
+ * @return A pointer to the next neighbor or NULL if it is not free
  */
 free_block *find_next(free_block *block) {
-    char *block_end = (char*)block + block->size + sizeof(free_block);
-    free_block *curr = HEAD;
-
-    while(curr != NULL) {
-        if((char *)curr == block_end)
-            return curr;
-        curr = curr->next;
-    }
-    return NULL;
+    header *next = next_block(block);
+    return (next->size & BLOCK_FREE) ? (free_block *)next : NULL;
 }
 
 /**
  * Remove a block from the free list
  *
+ * @param a The arena that owns the block
  * @param block The block to remove
  */
-void remove_free_block(free_block *block) {
-    free_block *curr = HEAD;
-    if(curr == block) {
-        HEAD = block->next;
+void remove_free_block(arena *a, free_block *block) {
+    a->free_bytes -= BLOCK_SIZE(block) + sizeof(header);
+#ifdef TU_POLICY_TREE
+    if (BLOCK_SIZE(block) > SMALL_MAX) {
+        tree_remove(&a->fit_tree, block_node(block));
         return;
     }
-    while(curr != NULL) {
-        if(curr->next == block) {
-            curr->next = block->next;
-            return;
-        }
-        curr = curr->next;
+#endif
+
+    int bin = size_to_bin(BLOCK_SIZE(block));
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    }
+    else {
+        a->bins[bin] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    if (a->bins[bin] == NULL) {
+        bin_clear(a, bin);
     }
 }
 
+/**
+ * Clear the words left between two merged known-zero blocks: the footer of
+ * the lower one and the header and free-list link of the upper one
+ *
+ * @param upper The upper of the two blocks
+ */
+static void clear_seam(free_block *upper) {
+    size_t size = BLOCK_SIZE(upper);
+    size_t links = free_links(size);
+    memset((char *)upper - sizeof(footer), 0, sizeof(footer) + sizeof(header) + (links < size ? links : size));
+}
+
 /**
  * Coalesce neighboring free blocks
  *
+ * The block must not be on a free list yet. The merged block is returned
+ * marked free but not inserted, so the caller decides where it goes. It
+ * stays BLOCK_ZERO only if every part of it was.
+ *
+ * @param a The arena that owns the block
  * @param block The block to coalesce
  * @return A pointer to the first block of the coalesced blocks
  */
-void *coalesce(free_block *block) {
+void *coalesce(arena *a, free_block *block) {
     if (block == NULL) {
         return NULL;
     }
 
     free_block *prev = find_prev(block);
     free_block *next = find_next(block);
+    int zero = (block->size & BLOCK_ZERO) != 0;
 
-    // Coalesce with previous block if it is contiguous.
+    // Coalesce with previous block; it changes size, so it has to leave its bin.
     if (prev != NULL) {
-        char *end_of_prev = (char *)prev + prev->size + sizeof(free_block);
-        if (end_of_prev == (char *)block) {
-            prev->size += block->size + sizeof(free_block);
-
-            // Ensure prev->next is updated to skip over 'block', only if 'block' is directly next to 'prev'.
-            if (prev->next == block) {
-                prev->next = block->next;
-            }
-            block = prev; // Update block to point to the new coalesced block.
+        remove_free_block(a, prev);
+        zero = zero && (prev->size & BLOCK_ZERO);
+        prev->size += BLOCK_SIZE(block) + sizeof(header);
+        if (zero) {
+            clear_seam(block);
         }
+        block = prev;
     }
 
-    // Coalesce with next block if it is contiguous.
+    // Coalesce with next block if it is free.
     if (next != NULL) {
-        char *end_of_block = (char *)block + block->size + sizeof(free_block);
-        if (end_of_block == (char *)next) {
-            block->size += next->size + sizeof(free_block);
-
-            // Ensure block->next is updated to skip over 'next'.
-            block->next = next->next;
+        remove_free_block(a, next);
+        zero = zero && (next->size & BLOCK_ZERO);
+        block->size += BLOCK_SIZE(next) + sizeof(header);
+        if (zero) {
+            clear_seam(next);
         }
     }
 
+    if (zero) {
+        block->size |= BLOCK_ZERO;
+    }
+    else {
+        block->size &= ~(size_t)BLOCK_ZERO;
+    }
+    mark_free(block);
     return block;
 }
 
 /**
- * Call sbrk to get memory from the OS
+ * Grow an arena by exactly grow bytes of the heap region
  *
- * @param size The amount of memory to allocate
- * @return A pointer to the allocated memory
+ * The new memory takes the place of the arena's old epilogue when nobody
+ * else grew the region since the arena last did (merging with a free block
+ * at the top), and a new epilogue is written at its end. Otherwise another
+ * arena grew the region in between and the memory starts a new segment.
+ *
+ * @param a The arena to grow
+ * @param grow Bytes to take, a multiple of ALIGNMENT that fits two headers
+ * @return The free block covering the new memory (already in a bin) or NULL
  */
-void *do_alloc(size_t size) {
-    
-    void *p = sbrk(0); 
-    intptr_t addr = (intptr_t)p & (ALIGNMENT - 1);
-    intptr_t adjustment;
+static free_block *heap_grow(arena *a, size_t grow) {
+    header *hdr_start;
+    size_t prev_free = 0;
 
-    if (addr != 0) {
-        adjustment = ALIGNMENT - addr;
+    char *start = region_grow(&heap_regions[a->node], grow, a->node);
+    if (start == NULL || radix_set(start, grow, &heap_span) != 0) {
+        return NULL;
+    }
+    if (start == a->heap_end) {
+        hdr_start = (header *)(a->heap_end - sizeof(header));
+        prev_free = hdr_start->size & BLOCK_PREV_FREE;
     }
     else {
-        adjustment = 0;
+        hdr_start = (header *)start;
     }
-    void * block = sbrk(size + sizeof(header) + adjustment);
-    if (block == (void *)-1) return NULL;  // aligns memory
-    void *headstart = (void *)((intptr_t)block + adjustment); 
-    header *hdr_start = (header *)headstart;
 
-    hdr_start->magic = 0x01234567;
-    hdr_start->size = size;
+    // Freshly committed pages are zero, so the chunk starts out BLOCK_ZERO.
+    header *epilogue = (header *)(start + grow - sizeof(header));
+    hdr_start->size = ((char *)epilogue - (char *)hdr_start - sizeof(header)) | prev_free | BLOCK_ZERO;
 
-    return (headstart + sizeof(header));
-}
+    epilogue->size = 0;
+    epilogue->magic = MAGIC;
+    epilogue->arena = a->index;
+    a->heap_end = (char *)epilogue + sizeof(header);
+    a->heap_bytes += grow;
 
+    free_block *block = coalesce(a, (free_block *)hdr_start);
+    insert_free_block(a, block);
+    return block;
+}
 
-void *tunextfit(size_t true_size) {
-    //printf("Starting tunextfit search\n"); //debug
-    if (HEAD == NULL) {
-        return NULL;
+/**
+ * Grow an arena by a chunk of the heap region
+ *
+ * Chunks start at CHUNK_MIN and double up to CHUNK_MAX, so the region is
+ * grown a handful of times per arena instead of once per allocation.
+ * Growth is rounded up to the region's commit granule, a whole huge page
+ * with TU_HUGEPAGES.
+ *
+ * @param a The arena to grow
+ * @param size The payload size the caller needs to fit
+ * @return The free block covering the new memory (already in a bin) or NULL
+ */
+void *do_alloc(arena *a, size_t size) {
+    if (a->chunk_size == 0) {
+        a->chunk_size = CHUNK_MIN;
     }
-    free_block *block = (last_allocated) ? last_allocated : HEAD; // current blk
-    if (block == NULL) {
-        block = HEAD; // wrap around to the beginning
-    }
-    free_block *start = block;
-
-    do {
-        printf("Checking if block at %p (size %zu) against required %zu\n", block, block->size, true_size);
-                
-       // check: can it be split and leave enough room for another free block?
-        if (block->size >= true_size) { 
-            printf("Found suitable block\n");
-            remove_free_block(block); 
-
-            void *split_blk = split(block, true_size);
-            if (split_blk) {
-                printf("Splitting block. Remaining size: %zu\n", ((free_block*)split_blk)->size);
-                free_block *unused = (free_block*)split_blk;    
-                unused->next = HEAD;
-                HEAD = unused;
-            }
-            last_allocated = block->next ? block->next : HEAD;
-
-            header *hdr = (header *)block;
-            hdr->size = true_size - sizeof(header);
-            hdr->magic = 0x01234567;
-            printf("Allocating block at %p with magic 0x%x\n", hdr, hdr->magic);
-            
-            return (void *)((char *)block + sizeof(header)); 
-        }
-        
-        block = block->next;
-        if (block == NULL) {
-            block = HEAD; 
-        }
-    } while (block != start);
+    size_t grow = a->chunk_size;
+    if (grow < size + 2 * sizeof(header)) {
+        grow = size + 2 * sizeof(header);
+    }
+    // The region commits whole granules anyway; take all of the last one.
+    size_t granule = region_granule();
+    grow = (grow + granule - 1) & ~(granule - 1);
 
- return NULL;
+    free_block *block = heap_grow(a, grow);
+    if (block != NULL && a->chunk_size < CHUNK_MAX) {
+        a->chunk_size *= 2;
+    }
+    return block;
 }
 
 
 /**
- * Allocates memory for the end user
+ * Allocate a free block the search policy picked: unlink it, give the
+ * unused tail back to the bins and hand out the rest
  *
- * @param size The amount of memory to allocate
- * @return A pointer to the requested block of memory
+ * @param a The arena that owns the block
+ * @param block The free block, at least size bytes
+ * @param size The aligned payload size
+ * @return A pointer to the user memory
  */
-void *tumalloc(size_t size) {
-    //printf("Requesting %zu bytes\n", size); // debug
-    void *ptr; 
+static void *take_block(arena *a, free_block *block, size_t size) {
+    TRACE(TRACE_FOUND, block, BLOCK_SIZE(block));
+    size_t links = free_links(BLOCK_SIZE(block));
+    remove_free_block(a, block);
 
-    if (HEAD == NULL) {
-        ptr = do_alloc(size); // confirmed good
-        return ptr;
+    free_block *unused = split(block, size);
+    if (unused) {
+        TRACE(TRACE_SPLIT, unused, BLOCK_SIZE(unused));
+        unused->size |= block->size & BLOCK_ZERO;
+        insert_free_block(a, unused);
     }
 
-    size_t true_size = size + sizeof(header);
-    ptr = tunextfit(true_size); // going through the free list w/ next-fit
-    if (ptr != NULL) {
-        //printf("Returning nextfit ptr\n");
-        return ptr;
-    }
-    else {
-        //printf("ptr was null, setting ptr to do_alloc(size) and returning\n");
-        ptr = do_alloc(size);
-        return ptr;
+    if (block->size & BLOCK_ZERO) {
+        // Only the free-list links and, if it was not split off, the footer
+        // were ever written in a known-zero block.
+        char *payload = (char *)block + sizeof(header);
+        memset(payload, 0, links < BLOCK_SIZE(block) ? links : BLOCK_SIZE(block));
+        if (unused == NULL) {
+            memset(payload + BLOCK_SIZE(block) - sizeof(footer), 0, sizeof(footer));
+        }
     }
-}
 
+    mark_used(a, block);
+    TRACE(TRACE_ALLOC, block, BLOCK_SIZE(block));
 
+    return (void *)((char *)block + sizeof(header));
+}
+
+#ifdef TU_POLICY_TLSF
 /**
- * Allocates and initializes a list of elements for the end user
+ * Find a free block for a request with two-level segregated fit
  *
- * @param num How many elements to allocate
- * @param size The size of each element
- * @return A pointer to the requested block of initialized memory
+ * The request is rounded up to the next list boundary, so the head of any
+ * non-empty list at or above it is large enough. Two find-first-set steps
+ * on the bitmaps locate that list, which bounds the search by a constant
+ * no matter how many free blocks the arena holds.
+ *
+ * @param a The arena to search
+ * @param size The aligned payload size
+ * @return A pointer to the user memory or NULL if no free block fits
  */
-void *tucalloc(size_t num, size_t size) {
-
-    size_t total_size = num * size;
-    
-    void *ptr = tumalloc(total_size); //using tumalloc to allocate mem
-    
-    if (ptr != NULL) { 
-        memset(ptr, 0, total_size);
-        return ptr;
+void *tutlsf(arena *a, size_t size) {
+    size_t rounded = size;
+    if (size >= (1 << FL_SHIFT)) {
+        rounded += ((size_t)1 << (63 - __builtin_clzll(size) - SL_LOG2)) - 1;
     }
-    else {
+    if (rounded >= ((size_t)1 << FL_MAX_LOG2)) {
         return NULL;
     }
+
+    int bin = size_to_bin(rounded);
+    int fl = bin / SL_COUNT;
+    unsigned int sl_candidates = a->sl_map[fl] & (~0U << (bin % SL_COUNT));
+
+    if (sl_candidates == 0) {
+        unsigned long long fl_candidates = fl + 1 < FL_COUNT ? a->fl_map & (~0ULL << (fl + 1)) : 0;
+        if (fl_candidates == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctzll(fl_candidates);
+        sl_candidates = a->sl_map[fl];
+    }
+
+    return take_block(a, a->bins[fl * SL_COUNT + __builtin_ctz(sl_candidates)], size);
 }
 
+#define policy_fit tutlsf /**< Search the heap bins with TLSF */
+#elif defined(TU_POLICY_TREE)
 /**
- * Reallocates a chunk of memory with a bigger size
+ * Find a free block for a request in the free block tree: best fit, good
+ * fit or lowest-address first fit, depending on how the tree is ordered
  *
- * @param ptr A pointer to an already allocated piece of memory
- * @param new_size The new requested size to allocate
- * @return A new pointer containing the contents of ptr, but with the new_size
+ * An exact class holds only one size, so the first non-empty class at or
+ * above a small request is its best fit. Everything larger is in the
+ * tree, which finds the block in O(log n).
+ *
+ * @param a The arena to search
+ * @param size The aligned payload size
+ * @return A pointer to the user memory or NULL if no free block fits
  */
-void *turealloc(void *ptr, size_t new_size) {
-    if (ptr == NULL) {
-        return tumalloc(new_size);
+void *tutreefit(arena *a, size_t size) {
+    if (size <= SMALL_MAX) {
+        unsigned long long candidates = a->bin_map & (~0ULL << size_to_bin(size));
+        if (candidates != 0) {
+            return take_block(a, a->bins[__builtin_ctzll(candidates)], size);
+        }
     }
 
-    void *new_block = tumalloc(new_size);
-    if (new_block == NULL) {
-        return NULL; 
+    tree_node *node = tree_fit(a->fit_tree, size, FIT_SLACK(size));
+    if (node == NULL) {
+        return NULL;
     }
-   
-    header *hdr = (header *)((char *)ptr - sizeof(header));
-    if (hdr->magic != 0x01234567) {
-        printf("MEM CORRUPTION DETECTED IN TUREALLOC");
-        abort();
+    return take_block(a, node_block(node), size);
+}
+
+#define policy_fit tutreefit /**< Search the free block tree */
+#else
+/**
+ * Find a free block for a request by going straight to its size class
+ *
+ * Exact classes hold only blocks of the requested size, and every bin above
+ * the request's bin holds only larger blocks, so the only list that is ever
+ * walked is the request's own power-of-two range bin.
+ *
+ * @param a The arena to search
+ * @param size The aligned payload size
+ * @return A pointer to the user memory or NULL if no free block fits
+ */
+void *tunextfit(arena *a, size_t size) {
+    int bin = size_to_bin(size);
+    free_block *block = NULL;
+
+    if (bin >= SMALL_CLASSES) {
+        for (free_block *curr = a->bins[bin]; curr != NULL; curr = curr->next) {
+            TRACE(TRACE_CHECK, curr, BLOCK_SIZE(curr));
+            if (BLOCK_SIZE(curr) >= size) {
+                block = curr;
+                break;
+            }
+        }
+        bin++;
     }
-    else {
-        // copy the old data & use the smaller of old size or new_size
-        size_t copy_size = (hdr->size < new_size) ? hdr->size : new_size;
-        memcpy(new_block, ptr, copy_size);
 
-        tufree(ptr);
-        
-        return new_block;
+    if (block == NULL) {
+        unsigned long long candidates = bin < NUM_BINS ? a->bin_map & (~0ULL << bin) : 0;
+        if (candidates == 0) {
+            return NULL;
+        }
+        block = a->bins[__builtin_ctzll(candidates)];
     }
+
+    return take_block(a, block, size);
 }
 
+#define policy_fit tunextfit /**< Search the heap bins with segregated next fit */
+#endif
+
+
 /**
- * Removes used chunk of memory and returns it to the free list
+ * pthread_atfork() prepare handler: take every allocator lock, so that no
+ * other thread is halfway through changing the heap when fork() copies it
  *
- * @param ptr Pointer to the allocated piece of memory
+ * The order follows the nesting on the allocation paths: the thread cache
+ * list before the arenas (tcache_collect() flushes under it), the arenas
+ * before the regions they grow and the radix tree, and each region before
+ * the region list (region_grow() registers a region under its lock).
+ * maintenance_lock goes first; the maintenance thread never holds it while
+ * it works on the arenas.
  */
-void tufree(void *ptr) {
-    if (!ptr) return;
-
-    header *hdr = (header*)(ptr - sizeof(header));
-    //printf("Freeing memory at %p\n", ptr); //debug
-    //printf("Block size: %zu, Magic: 0x%08x\n", hdr->size + sizeof(header), hdr->magic);
+static void fork_prepare(void) {
+    pthread_mutex_lock(&maintenance_lock);
+    pthread_mutex_lock(&tcache_list_lock);
+    for (unsigned int i = 0; i < arena_count; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    for (unsigned int node = 0; node < NUMA_MAX_NODES; node++) {
+        pthread_mutex_lock(&heap_regions[node].lock);
+    }
+    slab_fork_lock();
+    buddy_fork_lock();
+    region_fork_lock();
+    radix_fork_lock();
+}
 
-    if (hdr->magic != 0x01234567) { // a bit diff from pseudocode, but still same test case.
-        printf("MEMORY CORRUPTION DETECTED\n");
-        fflush(stdout);
-        abort(); 
+/**
+ * pthread_atfork() parent handler: release the locks fork_prepare() took
+ */
+static void fork_parent(void) {
+    radix_fork_unlock();
+    region_fork_unlock();
+    buddy_fork_unlock();
+    slab_fork_unlock();
+    for (unsigned int node = NUMA_MAX_NODES; node-- > 0;) {
+        pthread_mutex_unlock(&heap_regions[node].lock);
     }
-    else {
-        free_block *block = (free_block *)hdr;
-        if (block->next == NULL && HEAD == block) {
-            // if the block is already in the free list
-            printf("Double free detected\n");
-            abort();
-        }
-        
-        block->size = hdr->size;
-        block->next = HEAD;
-        HEAD = block;
-        coalesce(block);
-        //printf("Free list head: %p\n", HEAD);
+    for (unsigned int i = arena_count; i-- > 0;) {
+        pthread_mutex_unlock(&arenas[i].lock);
     }
+    pthread_mutex_unlock(&tcache_list_lock);
+    pthread_mutex_unlock(&maintenance_lock);
+}
 
+/**
+ * pthread_atfork() child handler: release the locks as in the parent. Only
+ * the forking thread exists in the child, so the maintenance thread is gone
+ * and tufree() goes back to purging inline until tu_init() starts a new one.
+ * The membarrier() registration is redone by tu_init() as well.
+ */
+static void fork_child(void) {
+    maintenance_running = 0;
+    maintenance_stop = 0;
+    membarrier_ready = 0;
+    fork_parent();
 }
 
+/**
+ * Set up the arenas: ARENAS_PER_CPU for every online CPU, at most MAX_ARENAS,
+ * dealt out to the online NUMA nodes in turn so that arena i belongs to
+ * node i % tu_numa_node_count(), and every node gets at least one
+ */
+static void arenas_init(void) {
+    tu_numa_init();
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long count = (cpus > 0 ? cpus : 1) * ARENAS_PER_CPU;
+    if (count < (long)tu_numa_node_count()) {
+        count = tu_numa_node_count();
+    }
+    arena_count = count < MAX_ARENAS ? (unsigned int)count : MAX_ARENAS;
+
+    for (unsigned int i = 0; i < arena_count; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].index = i;
+        arenas[i].node = i % tu_numa_node_count();
+        arenas[i].slabs.node = arenas[i].node;
+        arenas[i].buddy.node = arenas[i].node;
+    }
+
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/**
+ * Get the arena of the calling thread. On first use the thread is bound
+ * round-robin to one of the arenas of the node it runs on, so its memory
+ * is local as long as the scheduler keeps it there.
+ *
+ * @return The thread's arena
+ */
+static arena *get_arena(void) {
+    if (thread_arena == NULL) {
+        pthread_once(&arenas_once, arenas_init);
+        // The node's arenas are node, node + nodes, node + 2 * nodes, ...
+        unsigned int nodes = tu_numa_node_count();
+        unsigned int node = tu_numa_current_node();
+        unsigned int per_node = (arena_count - node + nodes - 1) / nodes;
+        unsigned int next = __atomic_fetch_add(&arena_next[node], 1, __ATOMIC_RELAXED);
+        thread_arena = &arenas[node + (next % per_node) * nodes];
+    }
+    return thread_arena;
+}
+
+/**
+ * Serve a large request with its own anonymous mapping, so that freeing it
+ * gives the memory straight back to the OS
+ *
+ * @param size The aligned payload size
+ * @return A pointer to the user memory or NULL if the mapping failed
+ */
+static void *mmap_alloc(size_t size) {
+    // Large requests bypass the arenas; make sure the fork handlers are
+    // registered before the radix tree lock is first taken.
+    pthread_once(&arenas_once, arenas_init);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - sizeof(header) - page) {
+        return NULL;
+    }
+    size_t length = (size + sizeof(header) + page - 1) & ~(page - 1);
+
+    void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (radix_set(map, length, &large_span) != 0) {
+        munmap(map, length);
+        return NULL;
+    }
+
+    header *hdr = (header *)map;
+    hdr->size = (length - sizeof(header)) | BLOCK_MMAPPED | BLOCK_ZERO;
+    hdr->magic = MAGIC;
+    hdr->arena = 0;
+    TRACE(TRACE_ALLOC, hdr, length - sizeof(header));
+
+    return (char *)hdr + sizeof(header);
+}
+
+/**
+ * Allocate a block from an arena. The arena lock must be held.
+ *
+ * @param a The arena to allocate from
+ * @param size The aligned payload size
+ * @return A pointer to the user memory or NULL if the OS is out of memory
+ */
+static void *heap_malloc(arena *a, size_t size) {
+    void *ptr = policy_fit(a, size); // going straight to the size class
+    if (ptr != NULL) {
+        return ptr;
+    }
+    if (do_alloc(a, size) == NULL) {
+        return NULL;
+    }
+    return policy_fit(a, size);
+}
+
+/**
+ * Read a coarse monotonic clock
+ *
+ * @return The time in milliseconds
+ */
+static unsigned long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + (unsigned long)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Release the whole pages inside a free block if it has been free since
+ * before the previous sweep
+ *
+ * MADV_DONTNEED rather than MADV_FREE: the resident set drops right away
+ * instead of whenever the kernel gets short of memory, and the pages read
+ * as zero afterwards, so a BLOCK_ZERO block stays zero either way. The
+ * header, links, stamp and footer sit outside the released pages.
+ *
+ * @param a The arena that owns the block
+ * @param block The free block, at least PURGE_MIN bytes
+ */
+static void purge_block(arena *a, free_block *block) {
+    unsigned long *stamp = purge_stamp(block);
+    if (*stamp == PURGED || *stamp >= a->purge_epoch) {
+        return;
+    }
+
+    // Only whole commit granules, so huge pages are not split up.
+    size_t page = region_granule();
+    uintptr_t start = ((uintptr_t)(stamp + 1) + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)next_block(block) - sizeof(footer)) & ~(uintptr_t)(page - 1);
+    if (start < end) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+    *stamp = PURGED;
+}
+
+#ifdef TU_POLICY_TREE
+/**
+ * Purge every block in a subtree of the free block tree
+ *
+ * @param a The arena that owns the tree
+ * @param node The root of the subtree
+ */
+static void purge_tree(arena *a, tree_node *node) {
+    for (; node != NULL; node = node->right) {
+        purge_tree(a, node->left);
+        if (node->size >= PURGE_MIN) {
+            purge_block(a, node_block(node));
+        }
+    }
+}
+#endif
+
+/**
+ * Purge the free blocks, empty slabs and free buddy blocks that have
+ * stayed free for at least DECAY_MS, once every DECAY_MS. The arena lock
+ * must be held.
+ *
+ * A block is stamped with the epoch it was binned in and purged by the
+ * first sweep after the epoch ends, so it is purged after DECAY_MS to
+ * twice that. Coalescing or splitting rebins a block, which restarts its
+ * clock. Slabs and buddy blocks keep epochs of their own the same way.
+ *
+ * @param a The arena to sweep
+ * @param now The current time in milliseconds
+ */
+static void heap_decay(arena *a, unsigned long now) {
+    if (DECAY_MS == 0 || now - a->last_sweep < DECAY_MS) {
+        return;
+    }
+
+    for (int bin = size_to_bin(PURGE_MIN); bin < NUM_BINS; bin++) {
+        for (free_block *curr = a->bins[bin]; curr != NULL; curr = curr->next) {
+            if (BLOCK_SIZE(curr) >= PURGE_MIN) {
+                purge_block(a, curr);
+            }
+        }
+    }
+#ifdef TU_POLICY_TREE
+    purge_tree(a, a->fit_tree);
+#endif
+    slab_purge(&a->slabs);
+#ifdef TU_POLICY_BUDDY
+    buddy_purge(&a->buddy);
+#endif
+
+    a->purge_epoch++;
+    a->last_sweep = now;
+}
+
+/**
+ * Get the free block at the top of an arena's newest segment. The arena
+ * lock must be held.
+ *
+ * @param a The arena
+ * @return The block right below the epilogue, or NULL if it is not free
+ */
+static free_block *top_block(arena *a) {
+    if (a->heap_end == NULL) {
+        return NULL;
+    }
+    return find_prev((free_block *)(a->heap_end - sizeof(header)));
+}
+
+/**
+ * Give the free top of an arena back to the OS by lowering the heap
+ * region's break. The arena lock must be held.
+ *
+ * Only the arena whose segment ends at the break can do this; when
+ * another arena has grown the region since, the top stays where it is.
+ *
+ * @param a The arena to trim
+ * @param pad Payload bytes to leave in the top block
+ * @return 1 if memory was released, 0 otherwise
+ */
+static int heap_trim(arena *a, size_t pad) {
+    free_block *top = top_block(a);
+    if (top == NULL || pad >= BLOCK_SIZE(top)) {
+        return 0;
+    }
+
+    // Keep the top block (at least ALIGNMENT bytes of it) and a new
+    // epilogue, ending on a commit granule boundary. pad is below the
+    // block size, so neither can run past the current epilogue.
+    size_t page = region_granule();
+    size_t keep = pad > ALIGNMENT ? ALIGN_UP(pad) : ALIGNMENT;
+    uintptr_t end = (uintptr_t)top + sizeof(header) + keep + sizeof(header);
+    char *new_end = (char *)((end + page - 1) & ~(uintptr_t)(page - 1));
+    char *old_end = a->heap_end;
+    if (new_end >= old_end) {
+        return 0;
+    }
+
+    // Unmap the range in the radix tree first: once the break is lowered,
+    // another arena may grow into it right away.
+    radix_set(new_end, old_end - new_end, NULL);
+    if (region_trim(&heap_regions[a->node], old_end, new_end) != 0) {
+        radix_set(new_end, old_end - new_end, &heap_span);
+        return 0;
+    }
+
+    remove_free_block(a, top);
+    size_t links = free_links(BLOCK_SIZE(top));
+    header *epilogue = (header *)(new_end - sizeof(header));
+    top->size = ((char *)epilogue - (char *)top - sizeof(header)) | (top->size & BLOCK_FLAGS);
+    if (top->size & BLOCK_ZERO) {
+        // A smaller block may no longer carry a purge stamp; clear the
+        // bookkeeping the larger one left behind.
+        memset((char *)top + sizeof(header), 0, links < BLOCK_SIZE(top) ? links : BLOCK_SIZE(top));
+    }
+    epilogue->size = 0;
+    epilogue->magic = MAGIC;
+    epilogue->arena = a->index;
+    mark_free(top);
+    insert_free_block(a, top);
+
+    a->heap_end = new_end;
+    a->heap_bytes -= old_end - new_end;
+    return 1;
+}
+
+/**
+ * Return an allocated block to its arena. The arena lock must be held.
+ *
+ * @param a The arena that owns the block
+ * @param hdr The header of the block
+ */
+static void heap_free(arena *a, header *hdr) {
+    free_block *block = (free_block *)hdr;
+    TRACE(TRACE_FREE, block, BLOCK_SIZE(block));
+    block->size &= ~(size_t)BLOCK_ZERO;
+    block->next = NULL;
+    block = coalesce(a, block);
+    insert_free_block(a, block);
+
+    if (__atomic_load_n(&maintenance_running, __ATOMIC_RELAXED)) {
+        return; // the maintenance thread purges and trims
+    }
+    if (BLOCK_SIZE(block) >= TRIM_THRESHOLD && (char *)next_block(block) + sizeof(header) == a->heap_end) {
+        heap_trim(a, TRIM_PAD);
+    }
+    heap_decay(a, now_ms());
+}
+
+/**
+ * Let a free path that bypassed heap_free() sweep the arena, unless the
+ * maintenance thread does that. The arena lock must be held.
+ *
+ * @param a The arena something was returned to
+ */
+static void free_decay(arena *a) {
+    if (!__atomic_load_n(&maintenance_running, __ATOMIC_RELAXED)) {
+        heap_decay(a, now_ms());
+    }
+}
+
+/**
+ * Start working on the calling thread's cache
+ *
+ * The owner and the maintenance thread hand the cache over Dekker style:
+ * the owner sets in_use and then checks steal, the maintenance thread sets
+ * steal and then checks in_use. The owner only needs a compiler barrier
+ * here because the maintenance thread runs membarrier() between its store
+ * and its load, which puts a full barrier into every running thread, so
+ * at least one side always sees the other's flag.
+ *
+ * @param cache The thread's cache
+ */
+static void tcache_enter(tcache *cache) {
+    __atomic_store_n(&cache->in_use, 1, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&cache->steal, __ATOMIC_ACQUIRE)) {
+        // Being flushed right now; step back until it is done.
+        __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&cache->steal, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        __atomic_store_n(&cache->in_use, 1, __ATOMIC_RELAXED);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&cache->ops, cache->ops + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stop working on the calling thread's cache
+ *
+ * @param cache The thread's cache
+ */
+static void tcache_leave(tcache *cache) {
+    __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Give up to count cached blocks of a class back to their arenas
+ *
+ * Blocks freed by this thread may come from any arena, so the lock is
+ * switched whenever the next block belongs to a different one.
+ *
+ * @param cache The thread cache to drain
+ * @param cls The size class
+ * @param count How many blocks to flush
+ */
+static void tcache_flush(tcache *cache, int cls, unsigned int count) {
+    arena *locked = NULL;
+
+    while (count-- > 0 && cache->bins[cls] != NULL) {
+        cache_entry *entry = cache->bins[cls];
+        cache->bins[cls] = entry->next;
+        cache->count[cls]--;
+
+        int in_slab = radix_lookup(entry)->kind == SPAN_SLAB;
+        header *hdr = (header *)((char *)entry - sizeof(header));
+        arena *a = &arenas[in_slab ? slab_owner(entry) : hdr->arena];
+        if (a != locked) {
+            if (locked != NULL) {
+                free_decay(locked);
+                pthread_mutex_unlock(&locked->lock);
+            }
+            pthread_mutex_lock(&a->lock);
+            locked = a;
+        }
+        if (in_slab) {
+            slab_free(&a->slabs, entry);
+        }
+        else {
+            heap_free(a, hdr);
+        }
+    }
+    if (locked != NULL) {
+        free_decay(locked);
+        pthread_mutex_unlock(&locked->lock);
+    }
+}
+
+/**
+ * Thread exit destructor: hand everything the thread cached back to the heap
+ *
+ * Other destructors and libc's own thread teardown may still allocate and
+ * free after this. Nothing would flush the cache again, so from here on
+ * the thread's blocks go straight to and from the arenas.
+ *
+ * @param arg Unused
+ */
+static void tcache_destroy(void *arg) {
+    tcache *cache = arg;
+
+    tcache_enter(cache);
+    cache->shut_down = 1;
+    for (int cls = 0; cls < SMALL_CLASSES; cls++) {
+        tcache_flush(cache, cls, TCACHE_MAX);
+    }
+    tcache_leave(cache);
+
+    pthread_mutex_lock(&tcache_list_lock);
+    if (cache->prev_cache != NULL) {
+        cache->prev_cache->next_cache = cache->next_cache;
+    }
+    else {
+        tcache_list = cache->next_cache;
+    }
+    if (cache->next_cache != NULL) {
+        cache->next_cache->prev_cache = cache->prev_cache;
+    }
+    pthread_mutex_unlock(&tcache_list_lock);
+}
+
+static void tcache_key_create(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/**
+ * Arm the thread exit destructor of a cache and make it visible to the
+ * maintenance thread
+ *
+ * @param cache The calling thread's cache
+ */
+static void tcache_register(tcache *cache) {
+    pthread_once(&tcache_key_once, tcache_key_create);
+    pthread_setspecific(tcache_key, cache);
+    cache->registered = 1;
+
+    pthread_mutex_lock(&tcache_list_lock);
+    cache->prev_cache = NULL;
+    cache->next_cache = tcache_list;
+    if (tcache_list != NULL) {
+        tcache_list->prev_cache = cache;
+    }
+    tcache_list = cache;
+    pthread_mutex_unlock(&tcache_list_lock);
+}
+
+/**
+ * The value cached blocks of a thread carry in cache_entry.key
+ *
+ * @param cache The thread cache
+ * @return The key
+ */
+static uintptr_t tcache_key_of(tcache *cache) {
+    return (uintptr_t)cache ^ (uintptr_t)TCACHE_COOKIE;
+}
+
+/**
+ * Push a block the caller just freed onto the thread cache, flushing part
+ * of the class to the heap first if it is full
+ *
+ * @param ptr The user pointer of the block
+ * @param cls The size class
+ */
+static void tcache_put(void *ptr, int cls) {
+    tcache *cache = &thread_cache;
+    cache_entry *entry = ptr;
+
+    tcache_enter(cache);
+    if (entry->key == tcache_key_of(cache)) {
+        // Probably a double free; user data can match the key by chance, so check.
+        for (cache_entry *curr = cache->bins[cls]; curr != NULL; curr = curr->next) {
+            if (curr == entry) {
+                report_and_abort("Double free detected");
+            }
+        }
+    }
+
+    if (cache->shut_down) {
+        // The class is empty since tcache_destroy(), so this flushes just the block.
+        entry->next = NULL;
+        cache->bins[cls] = entry;
+        cache->count[cls] = 1;
+        tcache_flush(cache, cls, 1);
+        tcache_leave(cache);
+        return;
+    }
+
+    if (!cache->registered) {
+        tcache_register(cache);
+    }
+    if (cache->count[cls] >= TCACHE_MAX) {
+        tcache_flush(cache, cls, TCACHE_BATCH);
+    }
+    entry->key = tcache_key_of(cache);
+    entry->next = cache->bins[cls];
+    cache->bins[cls] = entry;
+    cache->count[cls]++;
+    tcache_leave(cache);
+}
+
+/**
+ * Refill an empty thread cache class from the slabs of the thread's arena
+ * in one lock round trip. After tcache_destroy() only the caller's block
+ * is taken.
+ *
+ * @param cache The thread cache
+ * @param cls The size class
+ * @return A block for the caller, or NULL if out of memory
+ */
+static void *tcache_refill(tcache *cache, int cls) {
+    size_t size = (size_t)(cls + 1) * ALIGNMENT;
+    arena *a = get_arena();
+    int batch = cache->shut_down ? 1 : TCACHE_BATCH;
+
+    if (!cache->registered && !cache->shut_down) {
+        tcache_register(cache);
+    }
+
+    pthread_mutex_lock(&a->lock);
+    void *ptr = slab_alloc(&a->slabs, a->index, cls, size);
+    for (int i = 1; ptr != NULL && i < batch; i++) {
+        cache_entry *entry = slab_alloc(&a->slabs, a->index, cls, size);
+        if (entry == NULL) {
+            break;
+        }
+        entry->key = tcache_key_of(cache);
+        entry->next = cache->bins[cls];
+        cache->bins[cls] = entry;
+        cache->count[cls]++;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    return ptr;
+}
+
+/**
+ * Allocates memory for the end user
+ *
+ * Small requests are served from the calling thread's cache without
+ * touching shared state; everything else locks the thread's arena.
+ *
+ * @param size The amount of memory to allocate
+ * @return A pointer to the requested block of memory, or NULL if size is
+ *         above MAX_REQUEST or the OS is out of memory
+ */
+void *tumalloc(size_t size) {
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    size = size ? ALIGN_UP(size) : ALIGNMENT;
+
+    if (size <= SMALL_MAX) {
+        tcache *cache = &thread_cache;
+        int cls = size_to_class(size);
+        tcache_enter(cache);
+        cache_entry *entry = cache->bins[cls];
+        if (entry == NULL) {
+            entry = tcache_refill(cache, cls);
+        }
+        else {
+            cache->bins[cls] = entry->next;
+            cache->count[cls]--;
+            entry->key = 0;
+        }
+        tcache_leave(cache);
+        return entry;
+    }
+
+    if (size >= MMAP_THRESHOLD) {
+        return mmap_alloc(size);
+    }
+
+    arena *a = get_arena();
+    pthread_mutex_lock(&a->lock);
+#ifdef TU_POLICY_BUDDY
+    void *ptr = size <= BUDDY_MAX ? buddy_alloc(&a->buddy, a->index, size) : heap_malloc(a, size);
+#else
+    void *ptr = heap_malloc(a, size);
+#endif
+    pthread_mutex_unlock(&a->lock);
+    return ptr;
+}
+
+
+/**
+ * Allocates and initializes a list of elements for the end user
+ *
+ * Blocks that are known to be fresh from the OS are already zero, so the
+ * memset is skipped for them.
+ *
+ * @param num How many elements to allocate
+ * @param size The size of each element
+ * @return A pointer to the requested block of initialized memory, or NULL if
+ *         num * size overflows
+ */
+void *tucalloc(size_t num, size_t size) {
+
+    size_t total_size;
+    if (__builtin_mul_overflow(num, size, &total_size)) {
+        return NULL;
+    }
+    
+    void *ptr = tumalloc(total_size); //using tumalloc to allocate mem
+    
+    if (ptr != NULL) { 
+        header *hdr = (header *)((char *)ptr - sizeof(header));
+        span_kind kind = radix_lookup(ptr)->kind;
+        if ((kind != SPAN_HEAP && kind != SPAN_LARGE) || !(hdr->size & BLOCK_ZERO)) {
+            memset(ptr, 0, total_size);
+        }
+        return ptr;
+    }
+    else {
+        return NULL;
+    }
+}
+
+/**
+ * Shrink an allocated block in place, giving the tail back to the arena.
+ * The arena lock must be held.
+ *
+ * @param a The arena that owns the block
+ * @param hdr The header of the block
+ * @param size The new aligned payload size
+ */
+static void shrink_in_place(arena *a, header *hdr, size_t size) {
+    free_block *rest = split((free_block *)hdr, size);
+    if (rest != NULL) {
+        insert_free_block(a, coalesce(a, rest));
+    }
+}
+
+/**
+ * Allocate memory whose address is a multiple of a power of two
+ *
+ * Anything above ALIGNMENT comes from the heap: a block with room for the
+ * worst misalignment plus a minimal free block in front is allocated, the
+ * part before the aligned address is freed as a block of its own and the
+ * unused tail is given back like a shrinking turealloc. The result is an
+ * ordinary heap block, so tufree, turealloc and tu_usable_size take it.
+ *
+ * @param alignment The alignment, a power of two
+ * @param size The amount of memory to allocate
+ * @return A pointer to the aligned memory, or NULL if alignment is not a
+ *         power of two, the request with its alignment slack is above
+ *         MAX_REQUEST or the OS is out of memory
+ */
+void *tu_memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return tumalloc(size);
+    }
+
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    size = size ? ALIGN_UP(size) : ALIGNMENT;
+    size_t request;
+    if (__builtin_add_overflow(size, alignment + sizeof(header) + ALIGNMENT, &request) || request > MAX_REQUEST) {
+        return NULL;
+    }
+
+    arena *a = get_arena();
+    pthread_mutex_lock(&a->lock);
+    char *ptr = heap_malloc(a, request);
+    if (ptr == NULL) {
+        pthread_mutex_unlock(&a->lock);
+        return NULL;
+    }
+
+    header *hdr = (header *)(ptr - sizeof(header));
+    if (((uintptr_t)ptr & (alignment - 1)) != 0) {
+        // Leave at least a header and ALIGNMENT bytes in front, the
+        // smallest block that can be freed.
+        uintptr_t aligned = ((uintptr_t)ptr + sizeof(header) + ALIGNMENT + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        header *body = (header *)(aligned - sizeof(header));
+        size_t lead_size = (char *)body - ptr;
+
+        body->size = (BLOCK_SIZE(hdr) - lead_size - sizeof(header)) | (hdr->size & BLOCK_ZERO);
+        body->magic = MAGIC;
+        body->arena = a->index;
+        hdr->size = lead_size | (hdr->size & BLOCK_PREV_FREE);
+        heap_free(a, hdr);
+
+        hdr = body;
+        ptr = (char *)aligned;
+    }
+    shrink_in_place(a, hdr, size);
+    pthread_mutex_unlock(&a->lock);
+
+    TRACE(TRACE_ALLOC, hdr, BLOCK_SIZE(hdr));
+    return ptr;
+}
+
+/**
+ * Grow an allocated block in place by absorbing a free successor, growing
+ * the arena first if the block (or its free successor) is the last one in
+ * the arena. The arena lock must be held.
+ *
+ * @param a The arena that owns the block
+ * @param hdr The header of the block
+ * @param size The new aligned payload size
+ * @return 1 if the block now holds size bytes, 0 if it has to move
+ */
+static int grow_in_place(arena *a, header *hdr, size_t size) {
+    header *next = next_block(hdr);
+    size_t have = BLOCK_SIZE(hdr);
+    header *after = next;
+
+    if (next->size & BLOCK_FREE) {
+        have += BLOCK_SIZE(next) + sizeof(header);
+        after = next_block(next);
+    }
+
+    if (have < size) {
+        // Only the top of the arena's newest segment can be extended.
+        if (BLOCK_SIZE(after) != 0 || (char *)after + sizeof(header) != a->heap_end) {
+            return 0;
+        }
+        if (do_alloc(a, size - have) == NULL) {
+            return 0;
+        }
+        next = next_block(hdr);
+        if (!(next->size & BLOCK_FREE) || BLOCK_SIZE(hdr) + sizeof(header) + BLOCK_SIZE(next) < size) {
+            return 0; // the region was grown elsewhere by another arena
+        }
+    }
+
+    remove_free_block(a, (free_block *)next);
+    hdr->size += BLOCK_SIZE(next) + sizeof(header);
+    next_block(hdr)->size &= ~(size_t)BLOCK_PREV_FREE;
+    shrink_in_place(a, hdr, size);
+    return 1;
+}
+
+/**
+ * Move a block's contents to a newly allocated block and free the old one
+ *
+ * @param ptr The block to move
+ * @param old_size The usable size of the block
+ * @param new_size The requested new size
+ * @return The new block, or NULL (leaving ptr alone) if out of memory
+ */
+static void *realloc_copy(void *ptr, size_t old_size, size_t new_size) {
+    void *new_block = tumalloc(new_size);
+    if (new_block == NULL) {
+        return NULL; 
+    }
+
+    // copy the old data & use the smaller of old size or new_size
+    size_t copy_size = (old_size < new_size) ? old_size : new_size;
+    memcpy(new_block, ptr, copy_size);
+
+    tufree(ptr);
+
+    return new_block;
+}
+
+/**
+ * Reallocates a chunk of memory with a bigger size
+ *
+ * Shrinking splits the tail off in place and growing absorbs a free
+ * successor (or the top of the arena) in place; the contents are only
+ * copied to a new block when neither is possible.
+ *
+ * @param ptr A pointer to an already allocated piece of memory
+ * @param new_size The new requested size to allocate
+ * @return A new pointer containing the contents of ptr, but with the new_size,
+ *         or NULL (leaving ptr alone) if new_size is above MAX_REQUEST or
+ *         the OS is out of memory
+ */
+void *turealloc(void *ptr, size_t new_size) {
+    if (ptr == NULL) {
+        return tumalloc(new_size);
+    }
+    if (new_size > MAX_REQUEST) {
+        return NULL;
+    }
+
+    size_t size = new_size ? ALIGN_UP(new_size) : ALIGNMENT;
+    size_t old_size;
+
+    span *s = radix_lookup(ptr);
+    if (s == NULL) {
+        report_and_abort("INVALID POINTER PASSED TO TUREALLOC");
+    }
+
+    if (s->kind == SPAN_SLAB) {
+        int cls = slab_class(ptr);
+        if (cls < 0) {
+            report_and_abort("MEM CORRUPTION DETECTED IN TUREALLOC");
+        }
+        old_size = (size_t)(cls + 1) * ALIGNMENT;
+        if (size <= old_size) {
+            return ptr; // slots have a fixed size
+        }
+        return realloc_copy(ptr, old_size, new_size);
+    }
+
+    if (s->kind == SPAN_BUDDY) {
+        old_size = buddy_size(ptr);
+        if (old_size == 0) {
+            report_and_abort("MEM CORRUPTION DETECTED IN TUREALLOC");
+        }
+        if (size <= old_size && (size > old_size / 2 || old_size == ((size_t)1 << BUDDY_MIN_LOG2))) {
+            return ptr; // still the smallest order that fits
+        }
+        return realloc_copy(ptr, old_size, new_size);
+    }
+
+    header *hdr = (header *)((char *)ptr - sizeof(header));
+    if (hdr->magic != MAGIC || (hdr->size & BLOCK_FREE)
+        || (s->kind == SPAN_LARGE) != !!(hdr->size & BLOCK_MMAPPED)) {
+        report_and_abort("MEM CORRUPTION DETECTED IN TUREALLOC");
+    }
+
+    old_size = BLOCK_SIZE(hdr);
+
+    if (s->kind == SPAN_LARGE) {
+        if (size >= MMAP_THRESHOLD) {
+            // Let the kernel move the page table entries instead of copying.
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            if (size > SIZE_MAX - sizeof(header) - page) {
+                return NULL;
+            }
+            size_t length = (size + sizeof(header) + page - 1) & ~(page - 1);
+            radix_set(hdr, old_size + sizeof(header), NULL);
+            void *map = mremap(hdr, old_size + sizeof(header), length, MREMAP_MAYMOVE);
+            if (map == MAP_FAILED || radix_set(map, length, &large_span) != 0) {
+                if (map != MAP_FAILED) {
+                    munmap(map, length);
+                }
+                radix_set(hdr, old_size + sizeof(header), &large_span);
+                return NULL;
+            }
+            hdr = (header *)map;
+            hdr->size = (length - sizeof(header)) | BLOCK_MMAPPED;
+            return (char *)hdr + sizeof(header);
+        }
+    }
+    else {
+        arena *a = &arenas[hdr->arena];
+        int in_place;
+
+        pthread_mutex_lock(&a->lock);
+        if (size <= old_size) {
+            shrink_in_place(a, hdr, size);
+            in_place = 1;
+        }
+        else {
+            in_place = grow_in_place(a, hdr, size);
+        }
+        pthread_mutex_unlock(&a->lock);
+
+        if (in_place) {
+            return ptr;
+        }
+    }
+
+    return realloc_copy(ptr, old_size, new_size);
+}
+
+/**
+ * Removes used chunk of memory and returns it to the free list
+ *
+ * @param ptr Pointer to the allocated piece of memory
+ */
+void tufree(void *ptr) {
+    if (!ptr) return;
+
+    span *s = radix_lookup(ptr);
+    if (s == NULL) {
+        report_and_abort("INVALID POINTER PASSED TO TUFREE");
+    }
+
+    if (s->kind == SPAN_SLAB) {
+        int cls = slab_class(ptr);
+        if (cls < 0) {
+            report_and_abort("MEMORY CORRUPTION DETECTED");
+        }
+        tcache_put(ptr, cls);
+        return;
+    }
+
+    if (s->kind == SPAN_BUDDY) {
+        if (buddy_size(ptr) == 0) {
+            report_and_abort(buddy_is_free(ptr) ? "Double free detected" : "MEMORY CORRUPTION DETECTED");
+        }
+        arena *a = &arenas[buddy_owner(ptr)];
+        pthread_mutex_lock(&a->lock);
+        buddy_free(&a->buddy, ptr);
+        free_decay(a);
+        pthread_mutex_unlock(&a->lock);
+        return;
+    }
+
+    header *hdr = (header*)(ptr - sizeof(header));
+    //printf("Freeing memory at %p\n", ptr); //debug
+    //printf("Block size: %zu, Magic: 0x%08x\n", hdr->size + sizeof(header), hdr->magic);
+
+    if (hdr->size & BLOCK_FREE) {
+        // if the block is already in the free list
+        report_and_abort("Double free detected");
+    }
+
+    if (hdr->magic != MAGIC) { // a bit diff from pseudocode, but still same test case.
+        report_and_abort("MEMORY CORRUPTION DETECTED");
+    }
+
+    if (s->kind == SPAN_LARGE) {
+        if (!(hdr->size & BLOCK_MMAPPED)) {
+            report_and_abort("MEMORY CORRUPTION DETECTED");
+        }
+        size_t length = BLOCK_SIZE(hdr) + sizeof(header);
+        TRACE(TRACE_FREE, hdr, BLOCK_SIZE(hdr));
+        radix_set(hdr, length, NULL);
+        munmap(hdr, length);
+        return;
+    }
+
+    if ((hdr->size & BLOCK_MMAPPED) || hdr->arena >= arena_count) {
+        report_and_abort("MEMORY CORRUPTION DETECTED");
+    }
+
+    size_t size = BLOCK_SIZE(hdr);
+    if (size <= SMALL_MAX) {
+        hdr->size &= ~(size_t)BLOCK_ZERO;
+        tcache_put(ptr, size_to_class(size));
+        return;
+    }
+
+    arena *a = &arenas[hdr->arena];
+    pthread_mutex_lock(&a->lock);
+    heap_free(a, hdr);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Get the number of bytes usable at a pointer returned by the allocator
+ *
+ * @param ptr Pointer to the allocated piece of memory
+ * @return The usable size, or 0 for NULL or a pointer the allocator does not own
+ */
+size_t tu_usable_size(void *ptr) {
+    span *s = ptr ? radix_lookup(ptr) : NULL;
+    if (s == NULL) {
+        return 0;
+    }
+
+    if (s->kind == SPAN_SLAB) {
+        int cls = slab_class(ptr);
+        return cls < 0 ? 0 : (size_t)(cls + 1) * ALIGNMENT;
+    }
+    if (s->kind == SPAN_BUDDY) {
+        return buddy_size(ptr);
+    }
+
+    header *hdr = (header *)((char *)ptr - sizeof(header));
+    return hdr->magic == MAGIC ? BLOCK_SIZE(hdr) : 0;
+}
+
+/**
+ * Give the free memory at the top of the heap back to the OS now, e.g.
+ * after a batch job has freed its working set
+ *
+ * Automatic trimming only kicks in when the free top block reaches
+ * TRIM_THRESHOLD and leaves some padding; this trims any amount.
+ *
+ * @param pad Bytes to leave free at the top of each arena
+ * @return 1 if any memory was released, 0 otherwise
+ */
+int tu_trim(size_t pad) {
+    int released = 0;
+
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        released |= heap_trim(a, pad);
+        pthread_mutex_unlock(&a->lock);
+    }
+    return released;
+}
+
+/**
+ * Find the largest free block of an arena. The arena lock must be held.
+ *
+ * @param a The arena
+ * @return The payload size of the largest free block, 0 if there is none
+ */
+static size_t largest_free(arena *a) {
+    size_t largest = 0;
+    free_block *list = NULL;
+
+#ifdef TU_POLICY_TREE
+    if (a->fit_tree != NULL) {
+        return a->fit_tree->max; // every tree block is larger than every binned one
+    }
+#endif
+
+    // Only the highest non-empty bin can hold the largest block.
+#ifdef TU_POLICY_TLSF
+    if (a->fl_map != 0) {
+        int fl = 63 - __builtin_clzll(a->fl_map);
+        list = a->bins[fl * SL_COUNT + 31 - __builtin_clz(a->sl_map[fl])];
+    }
+#else
+    if (a->bin_map != 0) {
+        list = a->bins[63 - __builtin_clzll(a->bin_map)];
+    }
+#endif
+    for (; list != NULL; list = list->next) {
+        if (BLOCK_SIZE(list) > largest) {
+            largest = BLOCK_SIZE(list);
+        }
+    }
+    return largest;
+}
+
+/**
+ * Add the heap usage of one arena to a running total
+ *
+ * @param a The arena, whose lock must not be held
+ * @param stats The totals to add to
+ */
+static void arena_stats(arena *a, tu_stats *stats) {
+    pthread_mutex_lock(&a->lock);
+    stats->heap_bytes += a->heap_bytes;
+    stats->free_bytes += a->free_bytes;
+    size_t largest = largest_free(a);
+    if (largest > stats->largest_free) {
+        stats->largest_free = largest;
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**
+ * Sum up the heap usage of all arenas
+ *
+ * huge_bytes is read from /proc/self/smaps, which takes a while; this is
+ * not meant for hot paths.
+ *
+ * @param stats Where to store the totals
+ */
+void tu_get_stats(tu_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    for (unsigned int i = 0; i < arena_count; i++) {
+        arena_stats(&arenas[i], stats);
+    }
+    stats->huge_bytes = region_huge_bytes();
+}
+
+/**
+ * Get the number of NUMA nodes the arenas are spread over. The allocator
+ * numbers them from 0 in the order of the kernel's list of online nodes.
+ *
+ * @return 1 on machines without NUMA
+ */
+unsigned int tu_node_count(void) {
+    pthread_once(&arenas_once, arenas_init);
+    return tu_numa_node_count();
+}
+
+/**
+ * Get the kernel's id of a node, which differs from its number when the
+ * online nodes are not contiguous
+ *
+ * @param node The node, below tu_node_count()
+ * @return Its id, as in /sys/devices/system/node/node<id>, or -1 if there is no such node
+ */
+int tu_node_id(unsigned int node) {
+    if (node >= tu_node_count()) {
+        return -1;
+    }
+    return (int)tu_numa_node_id(node);
+}
+
+/**
+ * Sum up the heap usage of the arenas of one NUMA node. huge_bytes is
+ * left at 0; only tu_get_stats() counts huge pages.
+ *
+ * @param node The node, below tu_node_count()
+ * @param stats Where to store the totals
+ * @return 0 on success, -1 if there is no such node
+ */
+int tu_get_node_stats(unsigned int node, tu_stats *stats) {
+    if (node >= tu_node_count()) {
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    for (unsigned int i = 0; i < arena_count; i++) {
+        if (arenas[i].node == node) {
+            arena_stats(&arenas[i], stats);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Flush the caches of threads that have not allocated or freed anything
+ * since the last look, so that their blocks can be reused elsewhere
+ *
+ * One membarrier() covers every cache taken over in a pass; see
+ * tcache_enter() for the other side of the handshake.
+ */
+static void tcache_collect(void) {
+    int stealing = 0;
+
+    pthread_mutex_lock(&tcache_list_lock);
+    for (tcache *cache = tcache_list; cache != NULL; cache = cache->next_cache) {
+        unsigned long ops = __atomic_load_n(&cache->ops, __ATOMIC_RELAXED);
+        int idle = ops == cache->seen_ops;
+        cache->seen_ops = ops;
+
+        unsigned int cached = 0;
+        for (int cls = 0; idle && cls < SMALL_CLASSES; cls++) {
+            cached += __atomic_load_n(&cache->count[cls], __ATOMIC_RELAXED);
+        }
+        if (idle && cached != 0) {
+            __atomic_store_n(&cache->steal, 1, __ATOMIC_RELAXED);
+            stealing = 1;
+        }
+    }
+
+    if (stealing) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        for (tcache *cache = tcache_list; cache != NULL; cache = cache->next_cache) {
+            if (!cache->steal) {
+                continue;
+            }
+            if (!__atomic_load_n(&cache->in_use, __ATOMIC_ACQUIRE)) {
+                for (int cls = 0; cls < SMALL_CLASSES; cls++) {
+                    tcache_flush(cache, cls, TCACHE_MAX);
+                }
+            }
+            __atomic_store_n(&cache->steal, 0, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&tcache_list_lock);
+}
+
+/**
+ * One maintenance pass over an arena: purge decayed pages, trim a large
+ * free top and grow the heap ahead of time if little is left free. The
+ * arena lock must be held.
+ *
+ * @param a The arena
+ * @param now The current time in milliseconds
+ */
+static void arena_maintain(arena *a, unsigned long now) {
+    heap_decay(a, now);
+
+    free_block *top = top_block(a);
+    if (top != NULL && BLOCK_SIZE(top) >= TRIM_THRESHOLD) {
+        heap_trim(a, maintenance_reserve > TRIM_PAD ? maintenance_reserve : TRIM_PAD);
+    }
+
+    // Only arenas that have been used get memory ahead of time. More than
+    // the region holds cannot be had, and rounding it up could wrap.
+    if (a->heap_end != NULL && a->free_bytes < maintenance_reserve
+        && maintenance_reserve - a->free_bytes <= REGION_SIZE) {
+        size_t page = region_granule();
+        heap_grow(a, (maintenance_reserve - a->free_bytes + page - 1) & ~(page - 1));
+    }
+}
+
+/**
+ * Body of the maintenance thread: wake up every interval and maintain
+ * every arena and the thread caches, until tu_fini()
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *maintenance_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&maintenance_lock);
+    while (!maintenance_stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += maintenance_interval_ms / 1000;
+        until.tv_nsec += (long)(maintenance_interval_ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&maintenance_wake, &maintenance_lock, &until);
+        if (maintenance_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&maintenance_lock);
+
+        unsigned long now = now_ms();
+        for (unsigned int i = 0; i < arena_count; i++) {
+            pthread_mutex_lock(&arenas[i].lock);
+            arena_maintain(&arenas[i], now);
+            pthread_mutex_unlock(&arenas[i].lock);
+        }
+        if (membarrier_ready) {
+            tcache_collect();
+        }
+
+        pthread_mutex_lock(&maintenance_lock);
+    }
+    pthread_mutex_unlock(&maintenance_lock);
+
+    return NULL;
+}
+
+/**
+ * Start the maintenance thread, which takes purging, trimming, flushing
+ * idle thread caches and growing the heap off the tumalloc/tufree paths
+ *
+ * Calling it again while the thread runs does nothing.
+ *
+ * @param options How to run the thread, or NULL for the defaults
+ * @return 0 on success, -1 if the thread could not be started
+ */
+int tu_init(const tu_options *options) {
+    pthread_mutex_lock(&maintenance_lock);
+    if (maintenance_running) {
+        pthread_mutex_unlock(&maintenance_lock);
+        return 0;
+    }
+
+    maintenance_interval_ms = MAINTENANCE_INTERVAL_MS;
+    maintenance_reserve = MAINTENANCE_RESERVE;
+    if (options != NULL) {
+        if (options->interval_ms != 0) {
+            maintenance_interval_ms = options->interval_ms;
+        }
+        maintenance_reserve = options->reserve;
+    }
+
+    pthread_once(&arenas_once, arenas_init);
+    // Without membarrier() the thread still runs, it just leaves thread caches alone.
+    membarrier_ready = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&maintenance_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    maintenance_stop = 0;
+    if (pthread_create(&maintenance_thread, NULL, maintenance_main, NULL) != 0) {
+        pthread_mutex_unlock(&maintenance_lock);
+        return -1;
+    }
+    __atomic_store_n(&maintenance_running, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&maintenance_lock);
+
+    return 0;
+}
+
+/**
+ * Stop the maintenance thread and wait for it to finish. tufree() purges
+ * and trims inline again afterwards.
+ */
+void tu_fini(void) {
+    pthread_mutex_lock(&maintenance_lock);
+    if (!maintenance_running) {
+        pthread_mutex_unlock(&maintenance_lock);
+        return;
+    }
+    maintenance_stop = 1;
+    pthread_cond_signal(&maintenance_wake);
+    pthread_mutex_unlock(&maintenance_lock);
+
+    pthread_join(maintenance_thread, NULL);
+    __atomic_store_n(&maintenance_running, 0, __ATOMIC_RELAXED);
+}
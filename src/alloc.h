@@ -3,25 +3,78 @@
 
 #include <stddef.h>
 
+#define BLOCK_FREE 0x1 /**< Size flag: this block is on a free list */
+#define BLOCK_PREV_FREE 0x2 /**< Size flag: the block right before this one is free */
+#define BLOCK_MMAPPED 0x4 /**< Size flag: the block is its own anonymous mapping */
+#define BLOCK_ZERO 0x8 /**< Size flag: the payload is fresh from the OS and still zero */
+#define BLOCK_FLAGS 0xF /**< Low bits of size used for flags (sizes are 16-byte aligned) */
+
 /**
  * Header for allocated blocks
  */
 typedef struct header {
-    size_t size; /**< Size of the block */
+    size_t size; /**< Size of the block, with BLOCK_* flags in the low bits */
     int magic; /**< Magic number for error checking */
+    unsigned int arena; /**< Index of the arena the block belongs to */
 } header;
 
 /**
  * Free block structure
+ *
+ * next overlays the header's magic and arena, prev lives in the first bytes of the
+ * payload, so together with the footer it fits in the 16-byte minimum block.
  */
 typedef struct free_block {
-    size_t size; /**< Size of the block */
+    size_t size; /**< Size of the block, with BLOCK_* flags in the low bits */
     struct free_block *next; /**< Pointer to the next free block */
+    struct free_block *prev; /**< Pointer to the previous free block */
 } free_block;
 
+/**
+ * Boundary tag stored in the last bytes of every free block, so the block
+ * after it can find its start when BLOCK_PREV_FREE is set
+ */
+typedef struct footer {
+    size_t size; /**< Size of the free block, without flags */
+} footer;
+
+/**
+ * Heap usage summed over all arenas, filled in by tu_get_stats(), or over
+ * the arenas of one NUMA node by tu_get_node_stats()
+ */
+typedef struct tu_stats {
+    size_t heap_bytes; /**< Bytes the arenas have taken from the heap region */
+    size_t free_bytes; /**< Bytes in free heap blocks, headers included */
+    size_t largest_free; /**< Payload size of the largest free heap block */
+    size_t huge_bytes; /**< Bytes of the heap, slab and buddy regions backed by transparent huge pages */
+} tu_stats;
+
+/**
+ * How tu_init() runs the maintenance thread
+ */
+typedef struct tu_options {
+    unsigned int interval_ms; /**< Time between maintenance passes, 0 for the default (100 ms) */
+    size_t reserve; /**< Free heap bytes kept ready in every used arena, 0 to never grow ahead */
+} tu_options;
+
 void *tumalloc(size_t size);
 void *tucalloc(size_t num, size_t size);
 void *turealloc(void *ptr, size_t new_size);
+void *tu_memalign(size_t alignment, size_t size);
 void tufree(void *ptr);
+size_t tu_usable_size(void *ptr);
+void tu_get_stats(tu_stats *stats);
+unsigned int tu_node_count(void);
+int tu_node_id(unsigned int node);
+int tu_get_node_stats(unsigned int node, tu_stats *stats);
+int tu_trim(size_t pad);
+int tu_init(const tu_options *options);
+void tu_fini(void);
+
+/**
+ * Write the allocator trace to a file descriptor. Only builds configured
+ * with TU_TRACE record anything; otherwise this does nothing.
+ */
+void tu_trace_dump(int fd);
 
 #endif //CYB3053_PROJECT2_ALLOC_H
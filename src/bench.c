@@ -0,0 +1,680 @@
+#include "alloc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SIZE 640 /**< Payload size of the blocks kept on the free list, above the slab classes */
+#define BENCH_OPS 2000 /**< Timed operations per free-list length */
+#define THREAD_MAX 16 /**< Largest thread count in the scaling benchmark */
+#define THREAD_ROUNDS 20000 /**< Allocate/free rounds per thread */
+#define THREAD_BATCH 32 /**< Objects live at once per thread */
+#define DOUBLING_MAX (1024 * 1024) /**< Final size of the doubling benchmark buffer */
+#define DOUBLING_RUNS 200 /**< Times the doubling sequence is repeated */
+#define HUGE_START (1024 * 1024) /**< First size of the huge resize benchmark */
+#define HUGE_MAX (256 * 1024 * 1024) /**< Final size of the huge resize benchmark */
+#define LATENCY_LIVE 4096 /**< Slots of the latency benchmark's working set */
+#define LATENCY_OPS 1000000 /**< Timed allocations (and as many frees) */
+#define LATENCY_MIN 528 /**< Smallest request, just above the slab classes */
+#define LATENCY_MAX (64 * 1024) /**< Largest request, below the mmap threshold */
+#define LATENCY_BUCKETS 16 /**< Histogram buckets, doubling from 32 ns */
+#define POW2_LIVE 8192 /**< Slots of the power-of-two benchmark's working set */
+#define POW2_OPS 2000000 /**< Allocate/free pairs in the power-of-two benchmark */
+#define POW2_MIN_LOG2 10 /**< Smallest power-of-two request, 1 KiB */
+#define POW2_MAX_LOG2 16 /**< Largest power-of-two request, 64 KiB */
+#define FRAG_LIVE 20000 /**< Slots of the fragmentation benchmark's working set */
+#define FRAG_OPS 1000000 /**< Allocate/free pairs in the fragmentation benchmark */
+#define FRAG_MIN 528 /**< Smallest request, just above the slab classes */
+#define FRAG_MAX (32 * 1024) /**< Largest request, below the mmap threshold */
+#define TRIM_BLOCKS 65536 /**< Blocks of the trim benchmark's batch job */
+#define TRIM_SIZE 1000 /**< Payload size of those blocks */
+#define DECAY_BLOCKS 4096 /**< Blocks of the decay benchmark's burst */
+#define DECAY_SIZE (16 * 1024) /**< Payload size of those blocks */
+#define DECAY_KEEP 8 /**< Every DECAY_KEEP-th burst block stays live */
+#define DECAY_SECONDS 25 /**< Default length of the decay benchmark */
+#define LIST_NODES (4 * 1024 * 1024) /**< Nodes of the list traversal benchmark */
+#define LIST_PASSES 5 /**< Timed walks over the whole list */
+#define NODES_BLOCKS 2048 /**< Blocks each thread of the NUMA benchmark keeps */
+#define NODES_SIZE 4096 /**< Payload size of those blocks, above the slab classes */
+
+/**
+ * Read a monotonic clock
+ *
+ * @return The current time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Cheap deterministic random numbers so runs are comparable
+ *
+ * @return The next pseudo random number
+ */
+static unsigned long long next_rand(void) {
+    static unsigned long long state = 88172645463325252ULL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/**
+ * Measure free-list unlinking against free-list length
+ *
+ * For each length a heap of alternating guard/free blocks is built, so the
+ * free list for BENCH_SIZE holds `length` blocks. Freeing a random guard
+ * then merges it with both neighbours, which unlinks them from arbitrary
+ * positions of that list, and allocating BENCH_SIZE is a hit in the same
+ * list. Neither cost should grow with the length.
+ */
+static void bench_unlink(void) {
+    printf("%10s %16s %16s\n", "free list", "merge ns/op", "alloc hit ns/op");
+
+    for (size_t length = 1000; length <= 64000; length *= 4) {
+        void **guards = tumalloc(length * sizeof(void *));
+        void **frees = tumalloc(length * sizeof(void *));
+        void **hits = tumalloc(BENCH_OPS * sizeof(void *));
+
+        for (size_t i = 0; i < length; i++) {
+            guards[i] = tumalloc(BENCH_SIZE);
+            frees[i] = tumalloc(BENCH_SIZE);
+        }
+        for (size_t i = 0; i < length; i++) {
+            tufree(frees[i]);
+        }
+
+        // Free guards that still have two free neighbours.
+        double start = now_ns();
+        for (size_t i = 0; i < BENCH_OPS; i++) {
+            size_t pick = 1 + next_rand() % (length - 2);
+            if (guards[pick] != NULL) {
+                tufree(guards[pick]);
+                guards[pick] = NULL;
+            }
+        }
+        double merge = (now_ns() - start) / BENCH_OPS;
+
+        start = now_ns();
+        for (size_t i = 0; i < BENCH_OPS; i++) {
+            hits[i] = tumalloc(BENCH_SIZE);
+        }
+        double hit = (now_ns() - start) / BENCH_OPS;
+
+        printf("%10zu %16.1f %16.1f\n", length, merge, hit);
+
+        for (size_t i = 0; i < BENCH_OPS; i++) {
+            tufree(hits[i]);
+        }
+        for (size_t i = 0; i < length; i++) {
+            tufree(guards[i]);
+        }
+        tufree(hits);
+        tufree(frees);
+        tufree(guards);
+    }
+}
+
+/**
+ * Worker for the scaling benchmark: allocate a batch of small objects of
+ * mixed sizes, touch them and free them again, over and over
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *thread_worker(void *arg) {
+    void *live[THREAD_BATCH];
+    (void)arg;
+
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < THREAD_BATCH; i++) {
+            size_t size = 16 + (size_t)((round + i) % 8) * 32;
+            live[i] = tumalloc(size);
+            memset(live[i], i, size);
+        }
+        for (int i = 0; i < THREAD_BATCH; i++) {
+            tufree(live[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Measure small-object throughput for 1 to THREAD_MAX threads
+ *
+ * Every thread does the same amount of work, so with no shared state on
+ * the hot path the wall time should stay flat as threads are added (up to
+ * the number of cores).
+ */
+static void bench_threads(void) {
+    pthread_t threads[THREAD_MAX];
+    double base = 0;
+
+    printf("%8s %14s %10s\n", "threads", "Mops/s", "speedup");
+
+    for (int count = 1; count <= THREAD_MAX; count *= 2) {
+        double start = now_ns();
+        for (int i = 0; i < count; i++) {
+            pthread_create(&threads[i], NULL, thread_worker, NULL);
+        }
+        for (int i = 0; i < count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        double elapsed = now_ns() - start;
+
+        double ops = 2.0 * THREAD_ROUNDS * THREAD_BATCH * count;
+        double rate = ops / elapsed * 1e3;
+        if (count == 1) {
+            base = rate;
+        }
+        printf("%8d %14.2f %10.2f\n", count, rate, rate / base);
+    }
+}
+
+/**
+ * Measure a buffer grown by repeated doubling with turealloc, the way a
+ * string builder or vector grows, and count how often it had to move
+ */
+static void bench_doubling(void) {
+    unsigned long reallocs = 0;
+    unsigned long moves = 0;
+
+    double start = now_ns();
+    for (int run = 0; run < DOUBLING_RUNS; run++) {
+        char *buf = tumalloc(16);
+        buf[0] = 1;
+        for (size_t size = 32; size <= DOUBLING_MAX; size *= 2) {
+            char *grown = turealloc(buf, size);
+            if (grown != buf) {
+                moves++;
+            }
+            reallocs++;
+            buf = grown;
+            buf[size - 1] = 1;
+        }
+        tufree(buf);
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%10s %12s %12s\n", "reallocs", "moved", "ns/realloc");
+    printf("%10lu %12lu %12.1f\n", reallocs, moves, elapsed / reallocs);
+}
+
+/**
+ * Grow a buffer from HUGE_START to HUGE_MAX by doubling, touching every
+ * page, either with turealloc or with an explicit malloc-copy-free
+ *
+ * @param use_realloc Whether to resize with turealloc
+ * @return Elapsed nanoseconds spent resizing
+ */
+static double huge_resize(int use_realloc) {
+    char *buf = tumalloc(HUGE_START);
+    memset(buf, 1, HUGE_START);
+    double resizing = 0;
+
+    for (size_t size = HUGE_START * 2; size <= HUGE_MAX; size *= 2) {
+        double start = now_ns();
+        char *grown;
+        if (use_realloc) {
+            grown = turealloc(buf, size);
+        }
+        else {
+            grown = tumalloc(size);
+            memcpy(grown, buf, size / 2);
+            tufree(buf);
+        }
+        resizing += now_ns() - start;
+
+        buf = grown;
+        memset(buf + size / 2, 1, size / 2);
+    }
+    tufree(buf);
+    return resizing;
+}
+
+/**
+ * Compare resizing huge mmap-backed buffers with turealloc (mremap)
+ * against the malloc-copy-free path
+ */
+static void bench_huge(void) {
+    double copy = huge_resize(0);
+    double remap = huge_resize(1);
+
+    printf("%-18s %12s\n", "path", "ms resizing");
+    printf("%-18s %12.2f\n", "malloc-copy-free", copy / 1e6);
+    printf("%-18s %12.2f\n", "turealloc", remap / 1e6);
+}
+
+/**
+ * Count a latency in its power-of-two histogram bucket
+ *
+ * @param histogram The buckets; the first is everything below 32 ns
+ * @param ns The measured latency
+ */
+static void latency_record(unsigned long *histogram, double ns) {
+    int bucket = 0;
+    for (double limit = 32; ns >= limit && bucket < LATENCY_BUCKETS - 1; limit *= 2) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+/**
+ * Time every single tumalloc and tufree on a fragmented heap and print the
+ * latency histograms
+ *
+ * Random sizes between the slab classes and the mmap threshold are
+ * allocated into random slots of a working set, freeing whatever was there
+ * before, so the arena's free lists fill with many blocks of mixed sizes.
+ * The interesting part is the tail: with a bounded search it must not grow
+ * with the number of free blocks.
+ */
+static void bench_latency(void) {
+    void **live = calloc(LATENCY_LIVE, sizeof(void *));
+    unsigned long malloc_hist[LATENCY_BUCKETS] = {0};
+    unsigned long free_hist[LATENCY_BUCKETS] = {0};
+    double malloc_max = 0, free_max = 0;
+
+    for (int i = 0; i < LATENCY_OPS; i++) {
+        size_t slot = next_rand() % LATENCY_LIVE;
+        size_t size = LATENCY_MIN + next_rand() % (LATENCY_MAX - LATENCY_MIN);
+
+        if (live[slot] != NULL) {
+            double start = now_ns();
+            tufree(live[slot]);
+            double ns = now_ns() - start;
+            latency_record(free_hist, ns);
+            free_max = ns > free_max ? ns : free_max;
+        }
+
+        double start = now_ns();
+        live[slot] = tumalloc(size);
+        double ns = now_ns() - start;
+        latency_record(malloc_hist, ns);
+        malloc_max = ns > malloc_max ? ns : malloc_max;
+    }
+
+    printf("%12s %12s %12s\n", "ns", "tumalloc", "tufree");
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        char label[16];
+        if (b < LATENCY_BUCKETS - 1) {
+            snprintf(label, sizeof(label), "< %lu", 32UL << b);
+        }
+        else {
+            snprintf(label, sizeof(label), ">= %lu", 32UL << (b - 1));
+        }
+        printf("%12s %12lu %12lu\n", label, malloc_hist[b], free_hist[b]);
+    }
+    printf("%12s %12.0f %12.0f\n", "max", malloc_max, free_max);
+
+    for (int i = 0; i < LATENCY_LIVE; i++) {
+        tufree(live[i]);
+    }
+    free(live);
+}
+
+/**
+ * Churn a pool of power-of-two buffers, the way page-sized buffer pools
+ * use the allocator, and report the speed and the peak resident set
+ *
+ * Every page of every buffer is touched, so the peak resident set against
+ * the peak number of live bytes shows how much memory the policy wastes on
+ * headers, rounding and fragmentation.
+ */
+static void bench_pow2(void) {
+    void **live = calloc(POW2_LIVE, sizeof(void *));
+    size_t *sizes = calloc(POW2_LIVE, sizeof(size_t));
+    size_t live_bytes = 0, peak_bytes = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < POW2_OPS; i++) {
+        size_t slot = next_rand() % POW2_LIVE;
+        size_t size = (size_t)1 << (POW2_MIN_LOG2 + next_rand() % (POW2_MAX_LOG2 - POW2_MIN_LOG2 + 1));
+
+        if (live[slot] != NULL) {
+            tufree(live[slot]);
+            live_bytes -= sizes[slot];
+        }
+        live[slot] = tumalloc(size);
+        for (size_t off = 0; off < size; off += 4096) {
+            ((char *)live[slot])[off] = 1;
+        }
+        sizes[slot] = size;
+        live_bytes += size;
+        peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+    }
+    double elapsed = now_ns() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%12s %16s %16s\n", "ns/pair", "peak live KiB", "peak RSS KiB");
+    printf("%12.1f %16zu %16ld\n", elapsed / POW2_OPS, peak_bytes / 1024, usage.ru_maxrss);
+
+    for (int i = 0; i < POW2_LIVE; i++) {
+        tufree(live[i]);
+    }
+    free(sizes);
+    free(live);
+}
+
+/**
+ * Pick a request size for the fragmentation benchmark: mostly small
+ * blocks, some medium ones and a few large ones, the mix that leaves
+ * holes a first-fit style search cannot reuse
+ *
+ * @return The size
+ */
+static size_t frag_size(void) {
+    unsigned long long r = next_rand() % 100;
+    if (r < 70) {
+        return FRAG_MIN + next_rand() % 1024;
+    }
+    if (r < 95) {
+        return 2048 + next_rand() % 6144;
+    }
+    return 8192 + next_rand() % (FRAG_MAX - 8192);
+}
+
+/**
+ * Churn a working set of mixed sizes and report how fragmented the heap
+ * ends up under the build's placement policy
+ *
+ * The sizes drift during the run (phases favour different ranges), so
+ * holes left by one phase have to be reused by requests of another. The
+ * report shows the heap the arena had to take, how much of it is free,
+ * and how much of the free memory sits in the largest block; the rest is
+ * external fragmentation.
+ */
+static void bench_frag(void) {
+    void **live = calloc(FRAG_LIVE, sizeof(void *));
+    size_t *sizes = calloc(FRAG_LIVE, sizeof(size_t));
+    size_t live_bytes = 0, peak_bytes = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < FRAG_OPS; i++) {
+        size_t slot = next_rand() % FRAG_LIVE;
+        size_t size = frag_size();
+        if (i / (FRAG_OPS / 4) % 2 == 1) {
+            size = FRAG_MIN + size / 4; // a phase of smaller requests
+        }
+
+        if (live[slot] != NULL) {
+            tufree(live[slot]);
+            live_bytes -= sizes[slot];
+        }
+        live[slot] = tumalloc(size);
+        sizes[slot] = size;
+        live_bytes += size;
+        peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+    }
+    double elapsed = now_ns() - start;
+
+    tu_stats stats;
+    tu_get_stats(&stats);
+    double frag = stats.free_bytes ? 100.0 * (1.0 - (double)stats.largest_free / stats.free_bytes) : 0;
+
+    printf("%10s %12s %12s %12s %12s %10s\n", "ns/pair", "peak live KiB", "heap KiB", "free KiB", "largest KiB", "frag %");
+    printf("%10.1f %12zu %12zu %12zu %12zu %10.1f\n", elapsed / FRAG_OPS, peak_bytes / 1024,
+           stats.heap_bytes / 1024, stats.free_bytes / 1024, stats.largest_free / 1024, frag);
+
+    for (int i = 0; i < FRAG_LIVE; i++) {
+        tufree(live[i]);
+    }
+    free(sizes);
+    free(live);
+}
+
+/**
+ * Read the current resident set size
+ *
+ * @return Resident KiB, or 0 if /proc is not available
+ */
+static long rss_kib(void) {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Run a batch job that fills the heap and frees everything again, and show
+ * the resident set before, after the frees (automatic trimming) and after
+ * tu_trim(0)
+ */
+static void bench_trim(void) {
+    void **blocks = calloc(TRIM_BLOCKS, sizeof(void *));
+    long before = rss_kib();
+
+    for (int i = 0; i < TRIM_BLOCKS; i++) {
+        blocks[i] = tumalloc(TRIM_SIZE);
+        memset(blocks[i], 1, TRIM_SIZE);
+    }
+    long peak = rss_kib();
+
+    for (int i = 0; i < TRIM_BLOCKS; i++) {
+        tufree(blocks[i]);
+    }
+    long freed = rss_kib();
+
+    double start = now_ns();
+    int released = tu_trim(0);
+    double elapsed = now_ns() - start;
+    long trimmed = rss_kib();
+
+    printf("%12s %12s %12s %12s %12s\n", "start KiB", "peak KiB", "freed KiB", "trimmed KiB", "trim us");
+    printf("%12ld %12ld %12ld %12ld %12.1f%s\n", before, peak, freed, trimmed, elapsed / 1e3,
+           released ? "" : " (nothing to trim)");
+    free(blocks);
+}
+
+/**
+ * Show the resident set over time after a traffic burst
+ *
+ * The burst allocates DECAY_BLOCKS blocks and frees all but every
+ * DECAY_KEEP-th one, so the freed memory is spread over the heap and
+ * cannot be trimmed from the top. A trickle of allocations keeps the
+ * allocator busy afterwards; once the decay time has passed, the free
+ * pages are purged and the resident set falls back towards the live data.
+ *
+ * @param seconds How long to watch
+ */
+static void bench_decay(int seconds) {
+    void **blocks = calloc(DECAY_BLOCKS, sizeof(void *));
+
+    for (int i = 0; i < DECAY_BLOCKS; i++) {
+        blocks[i] = tumalloc(DECAY_SIZE);
+        memset(blocks[i], 1, DECAY_SIZE);
+    }
+    for (int i = 0; i < DECAY_BLOCKS; i++) {
+        if (i % DECAY_KEEP != DECAY_KEEP - 1) {
+            tufree(blocks[i]);
+            blocks[i] = NULL;
+        }
+    }
+
+    printf("%8s %12s %12s\n", "seconds", "RSS KiB", "live KiB");
+    size_t live = (size_t)DECAY_BLOCKS / DECAY_KEEP * DECAY_SIZE / 1024;
+    for (int second = 0; second <= seconds; second++) {
+        printf("%8d %12ld %12zu\n", second, rss_kib(), live);
+        fflush(stdout);
+        for (int tick = 0; tick < 10 && second < seconds; tick++) {
+            tufree(tumalloc(TRIM_SIZE));
+            struct timespec pause = { 0, 100 * 1000 * 1000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    for (int i = 0; i < DECAY_BLOCKS; i++) {
+        tufree(blocks[i]);
+    }
+    free(blocks);
+}
+
+/** A node of the list traversal benchmark, one small slab class */
+typedef struct list_node {
+    struct list_node *next;
+    long value[3];
+} list_node;
+
+/**
+ * Walk a linked list whose nodes are linked in random order
+ *
+ * Almost every step lands on a different page, so the walk is bound by TLB
+ * misses. Compare a build with TU_HUGEPAGES against one without: with huge
+ * pages the whole list fits in a few dozen TLB entries.
+ */
+static void bench_list(void) {
+    list_node **nodes = malloc(LIST_NODES * sizeof(list_node *));
+    for (size_t i = 0; i < LIST_NODES; i++) {
+        nodes[i] = tumalloc(sizeof(list_node));
+        nodes[i]->value[0] = (long)i;
+    }
+
+    // Shuffle, then link in shuffled order.
+    for (size_t i = LIST_NODES - 1; i > 0; i--) {
+        size_t j = next_rand() % (i + 1);
+        list_node *swap = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = swap;
+    }
+    for (size_t i = 0; i + 1 < LIST_NODES; i++) {
+        nodes[i]->next = nodes[i + 1];
+    }
+    nodes[LIST_NODES - 1]->next = NULL;
+
+    long sum = 0;
+    double start = now_ns();
+    for (int pass = 0; pass < LIST_PASSES; pass++) {
+        for (list_node *node = nodes[0]; node != NULL; node = node->next) {
+            sum += node->value[0];
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    tu_stats stats;
+    tu_get_stats(&stats);
+    printf("%10s %12s %12s %12s\n", "nodes", "ns/node", "RSS KiB", "huge KiB");
+    printf("%10d %12.2f %12ld %12zu\n", LIST_NODES, elapsed / ((double)LIST_NODES * LIST_PASSES),
+           rss_kib(), stats.huge_bytes / 1024);
+    if (sum != (long)LIST_NODES * (LIST_NODES - 1) / 2 * LIST_PASSES) {
+        printf("List is broken\n");
+    }
+
+    for (size_t i = 0; i < LIST_NODES; i++) {
+        tufree(nodes[i]);
+    }
+    free(nodes);
+}
+
+/**
+ * Worker for the NUMA benchmark: allocate and touch NODES_BLOCKS blocks
+ * and leave them live for the caller to free
+ *
+ * @param arg An array of NODES_BLOCKS pointers to fill
+ * @return NULL
+ */
+static void *nodes_worker(void *arg) {
+    void **blocks = arg;
+    for (int i = 0; i < NODES_BLOCKS; i++) {
+        blocks[i] = tumalloc(NODES_SIZE);
+        memset(blocks[i], 1, NODES_SIZE);
+    }
+    return NULL;
+}
+
+/**
+ * Fill the heap from THREAD_MAX threads and show how much of it each NUMA
+ * node's arenas hold. Threads take memory from the arenas of the node they
+ * run on, so the split follows where the scheduler put them.
+ */
+static void bench_nodes(void) {
+    pthread_t threads[THREAD_MAX];
+    void **blocks = calloc((size_t)THREAD_MAX * NODES_BLOCKS, sizeof(void *));
+
+    for (int i = 0; i < THREAD_MAX; i++) {
+        pthread_create(&threads[i], NULL, nodes_worker, blocks + (size_t)i * NODES_BLOCKS);
+    }
+    for (int i = 0; i < THREAD_MAX; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("%7s %12s %12s\n", "node id", "heap KiB", "free KiB");
+    for (unsigned int node = 0; node < tu_node_count(); node++) {
+        tu_stats stats;
+        tu_get_node_stats(node, &stats);
+        printf("%7d %12zu %12zu\n", tu_node_id(node), stats.heap_bytes / 1024, stats.free_bytes / 1024);
+    }
+
+    for (size_t i = 0; i < (size_t)THREAD_MAX * NODES_BLOCKS; i++) {
+        tufree(blocks[i]);
+    }
+    free(blocks);
+}
+
+/**
+ * Allocator benchmarks. With -b the allocator's maintenance thread runs
+ * during the benchmark.
+ */
+int main(int argc, char** argv) {
+    int arg = 1;
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        tu_init(NULL);
+        arg++;
+    }
+    const char *name = argc > arg ? argv[arg] : "unlink";
+
+    if (strcmp(name, "unlink") == 0) {
+        bench_unlink();
+    }
+    else if (strcmp(name, "threads") == 0) {
+        bench_threads();
+    }
+    else if (strcmp(name, "doubling") == 0) {
+        bench_doubling();
+    }
+    else if (strcmp(name, "huge") == 0) {
+        bench_huge();
+    }
+    else if (strcmp(name, "latency") == 0) {
+        bench_latency();
+    }
+    else if (strcmp(name, "pow2") == 0) {
+        bench_pow2();
+    }
+    else if (strcmp(name, "frag") == 0) {
+        bench_frag();
+    }
+    else if (strcmp(name, "trim") == 0) {
+        bench_trim();
+    }
+    else if (strcmp(name, "decay") == 0) {
+        bench_decay(argc > arg + 1 ? atoi(argv[arg + 1]) : DECAY_SECONDS);
+    }
+    else if (strcmp(name, "list") == 0) {
+        bench_list();
+    }
+    else if (strcmp(name, "nodes") == 0) {
+        bench_nodes();
+    }
+    else {
+        printf("Unknown benchmark: %s\n", name);
+        printf("Usage: %s [-b] [unlink|threads|doubling|huge|latency|pow2|frag|trim|decay [seconds]|list|nodes]\n", argv[0]);
+        return 1;
+    }
+
+    tu_fini();
+    return 0;
+}
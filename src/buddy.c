@@ -0,0 +1,297 @@
+#include "buddy.h"
+#include "numa.h"
+#include "radix.h"
+#include "region.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#ifndef BUDDY_REGION_SIZE
+#define BUDDY_REGION_SIZE ((size_t)16 << 30) /**< Address space reserved for buddy chunks */
+#endif
+
+#define BUDDY_UNITS (BUDDY_MAX >> BUDDY_MIN_LOG2) /**< Smallest blocks per chunk */
+#define BUDDY_FREE 0x80 /**< Set in the state of a free block */
+#define BUDDY_PURGED (~0UL) /**< Purge stamp of a free block whose pages have been released */
+
+/**
+ * Link stored at the start of a free block
+ */
+typedef struct buddy_node {
+    struct buddy_node *next; /**< Next free block of the same order */
+    struct buddy_node *prev; /**< Previous free block of the same order */
+    unsigned long purge_stamp; /**< purge_epoch when the block was freed, or BUDDY_PURGED */
+} buddy_node;
+
+/**
+ * Bookkeeping for one BUDDY_MAX chunk. It lives outside the chunk, so
+ * blocks carry no header and a power-of-two request fills its block
+ * exactly. The radix tree maps the chunk's pages to the embedded span.
+ */
+typedef struct buddy_chunk {
+    span span; /**< What the radix tree maps the chunk's pages to */
+    char *base; /**< Start of the chunk */
+    unsigned int owner; /**< Arena the chunk belongs to */
+
+    /**
+     * Per smallest block: order + 1 if a block starts there, ORed with
+     * BUDDY_FREE while it is free, and 0 inside a block
+     */
+    unsigned char state[BUDDY_UNITS];
+} buddy_chunk;
+
+/** Chunks get their own aligned range per node, so a block's offset in its chunk is its address bits */
+static region buddy_regions[NUMA_MAX_NODES] = {
+    [0 ... NUMA_MAX_NODES - 1] = REGION_INITIALIZER(BUDDY_REGION_SIZE, BUDDY_MAX)
+};
+
+/**
+ * Find the chunk a block lives in
+ *
+ * @param ptr Any pointer into the chunk
+ * @return The chunk bookkeeping
+ */
+static buddy_chunk *chunk_of(const void *ptr) {
+    return (buddy_chunk *)radix_lookup(ptr);
+}
+
+/**
+ * Get the index of the state byte of a block
+ *
+ * @param c The chunk of the block
+ * @param block The block
+ * @return The index into c->state
+ */
+static size_t unit_of(const buddy_chunk *c, const void *block) {
+    return (size_t)((const char *)block - c->base) >> BUDDY_MIN_LOG2;
+}
+
+/**
+ * Push a free block onto the list of its order and mark it free
+ *
+ * @param bins The free lists of the owning arena
+ * @param c The chunk of the block
+ * @param block The block
+ * @param order The order of the block
+ */
+static void free_push(buddy_bins *bins, buddy_chunk *c, void *block, int order) {
+    buddy_node *node = block;
+    node->prev = NULL;
+    node->purge_stamp = bins->purge_epoch;
+    node->next = bins->free[order];
+    if (node->next != NULL) {
+        node->next->prev = node;
+    }
+    bins->free[order] = node;
+    bins->map |= 1U << order;
+    c->state[unit_of(c, block)] = (unsigned char)(order + 1) | BUDDY_FREE;
+}
+
+/**
+ * Unlink a free block from the list of its order
+ *
+ * @param bins The free lists of the owning arena
+ * @param block The block
+ * @param order The order of the block
+ */
+static void free_remove(buddy_bins *bins, void *block, int order) {
+    buddy_node *node = block;
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    }
+    else {
+        bins->free[order] = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    }
+    if (bins->free[order] == NULL) {
+        bins->map &= ~(1U << order);
+    }
+}
+
+/**
+ * Add a fresh chunk to an arena as one free block of the highest order
+ *
+ * @param bins The free lists of the arena
+ * @param owner Index of the arena
+ * @return 0 on success, -1 if out of memory
+ */
+static int chunk_new(buddy_bins *bins, unsigned int owner) {
+    buddy_chunk *c = mmap(NULL, sizeof(buddy_chunk), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) {
+        return -1;
+    }
+
+    c->base = region_grow(&buddy_regions[bins->node], BUDDY_MAX, bins->node);
+    if (c->base == NULL) {
+        munmap(c, sizeof(buddy_chunk));
+        return -1;
+    }
+    c->span.kind = SPAN_BUDDY;
+    c->owner = owner;
+    if (radix_set(c->base, BUDDY_MAX, &c->span) != 0) {
+        return -1;
+    }
+
+    free_push(bins, c, c->base, BUDDY_ORDERS - 1);
+    return 0;
+}
+
+/**
+ * Hand out a block of the smallest order that fits, halving a larger free
+ * block as often as needed. The owning arena's lock must be held.
+ *
+ * @param bins The free lists of the arena
+ * @param owner Index of the arena
+ * @param size The requested size, at most BUDDY_MAX
+ * @return The block or NULL if out of memory
+ */
+void *buddy_alloc(buddy_bins *bins, unsigned int owner, size_t size) {
+    int order = 0;
+    if (size > ((size_t)1 << BUDDY_MIN_LOG2)) {
+        order = (64 - __builtin_clzll(size - 1)) - BUDDY_MIN_LOG2;
+    }
+
+    unsigned int candidates = bins->map & (~0U << order);
+    if (candidates == 0) {
+        if (chunk_new(bins, owner) != 0) {
+            return NULL;
+        }
+        candidates = bins->map & (~0U << order);
+    }
+
+    int have = __builtin_ctz(candidates);
+    char *block = (char *)bins->free[have];
+    buddy_chunk *c = chunk_of(block);
+    free_remove(bins, block, have);
+
+    // Keep the lower half and free the upper one until the block fits.
+    while (have > order) {
+        have--;
+        free_push(bins, c, block + ((size_t)1 << (have + BUDDY_MIN_LOG2)), have);
+    }
+
+    c->state[unit_of(c, block)] = (unsigned char)(order + 1);
+    return block;
+}
+
+/**
+ * Return a block, merging it with its buddy for as long as the buddy is
+ * free and whole. The buddy of a block is found by flipping the bit of its
+ * size in its offset, so no list is searched. The owning arena's lock must
+ * be held.
+ *
+ * @param bins The free lists of the arena that owns the chunk
+ * @param ptr The block, which buddy_size() accepts
+ */
+void buddy_free(buddy_bins *bins, void *ptr) {
+    buddy_chunk *c = chunk_of(ptr);
+    size_t offset = (size_t)((char *)ptr - c->base);
+    int order = (c->state[offset >> BUDDY_MIN_LOG2] & ~BUDDY_FREE) - 1;
+
+    c->state[offset >> BUDDY_MIN_LOG2] = 0;
+    while (order < BUDDY_ORDERS - 1) {
+        size_t buddy = offset ^ ((size_t)1 << (order + BUDDY_MIN_LOG2));
+        if (c->state[buddy >> BUDDY_MIN_LOG2] != ((unsigned char)(order + 1) | BUDDY_FREE)) {
+            break;
+        }
+        free_remove(bins, c->base + buddy, order);
+        c->state[buddy >> BUDDY_MIN_LOG2] = 0;
+        offset &= buddy; // the merged block starts at the lower of the two
+        order++;
+    }
+
+    free_push(bins, c, c->base + offset, order);
+}
+
+/**
+ * Release the pages of the free blocks that have been free since before
+ * the previous call, and start a new epoch. The owning arena's lock must
+ * be held.
+ *
+ * The page holding a block's list node stays, and only whole commit
+ * granules are released (see region_granule()). Merging or splitting
+ * pushes a block again, which restarts its clock.
+ *
+ * @param bins The free lists of the arena
+ */
+void buddy_purge(buddy_bins *bins) {
+    uintptr_t page = region_granule();
+    for (int order = 0; order < BUDDY_ORDERS; order++) {
+        for (buddy_node *node = bins->free[order]; node != NULL; node = node->next) {
+            if (node->purge_stamp == BUDDY_PURGED || node->purge_stamp >= bins->purge_epoch) {
+                continue;
+            }
+            uintptr_t start = ((uintptr_t)(node + 1) + page - 1) & ~(page - 1);
+            uintptr_t end = ((uintptr_t)node + ((uintptr_t)1 << (order + BUDDY_MIN_LOG2))) & ~(page - 1);
+            if (start < end) {
+                madvise((void *)start, end - start, MADV_DONTNEED);
+            }
+            node->purge_stamp = BUDDY_PURGED;
+        }
+    }
+    bins->purge_epoch++;
+}
+
+/**
+ * Get the arena that owns the chunk of a block
+ *
+ * @param ptr The block
+ * @return Index of the owning arena
+ */
+unsigned int buddy_owner(const void *ptr) {
+    return chunk_of(ptr)->owner;
+}
+
+/**
+ * Get the size of a block, checking that the pointer really is the start
+ * of a block that has been handed out
+ *
+ * @param ptr The pointer to look up
+ * @return The block size, or 0 if ptr is not an allocated block
+ */
+size_t buddy_size(const void *ptr) {
+    buddy_chunk *c = chunk_of(ptr);
+    size_t offset = (size_t)((const char *)ptr - c->base);
+
+    if (offset & (((size_t)1 << BUDDY_MIN_LOG2) - 1)) {
+        return 0;
+    }
+    unsigned char state = c->state[offset >> BUDDY_MIN_LOG2];
+    if (state == 0 || (state & BUDDY_FREE)) {
+        return 0;
+    }
+    return (size_t)1 << (state - 1 + BUDDY_MIN_LOG2);
+}
+
+/**
+ * Check whether a pointer is the start of a free block, to tell a double
+ * free from a pointer that was never handed out
+ *
+ * @param ptr The pointer to look up
+ * @return 1 if ptr is a free block, 0 otherwise
+ */
+int buddy_is_free(const void *ptr) {
+    buddy_chunk *c = chunk_of(ptr);
+    size_t offset = (size_t)((const char *)ptr - c->base);
+
+    if (offset & (((size_t)1 << BUDDY_MIN_LOG2) - 1)) {
+        return 0;
+    }
+    return (c->state[offset >> BUDDY_MIN_LOG2] & BUDDY_FREE) != 0;
+}
+
+/** Keep other threads from carving buddy chunks while fork() copies the region */
+void buddy_fork_lock(void) {
+    for (unsigned int node = 0; node < NUMA_MAX_NODES; node++) {
+        pthread_mutex_lock(&buddy_regions[node].lock);
+    }
+}
+
+/** Release the lock taken by buddy_fork_lock(), in the parent or the child */
+void buddy_fork_unlock(void) {
+    for (unsigned int node = NUMA_MAX_NODES; node-- > 0;) {
+        pthread_mutex_unlock(&buddy_regions[node].lock);
+    }
+}
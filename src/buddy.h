@@ -0,0 +1,32 @@
+#ifndef CYB3053_PROJECT2_BUDDY_H
+#define CYB3053_PROJECT2_BUDDY_H
+
+#include <stddef.h>
+
+#define BUDDY_MIN_LOG2 10 /**< log2 of the smallest block, 1 KiB */
+#define BUDDY_MAX_LOG2 22 /**< log2 of a chunk, which is also the largest block */
+#define BUDDY_ORDERS (BUDDY_MAX_LOG2 - BUDDY_MIN_LOG2 + 1) /**< Number of block sizes */
+#define BUDDY_MAX ((size_t)1 << BUDDY_MAX_LOG2) /**< Largest request a buddy block can hold */
+
+struct buddy_node;
+
+/**
+ * The free buddy blocks of one arena, one list per order
+ */
+typedef struct buddy_bins {
+    struct buddy_node *free[BUDDY_ORDERS]; /**< Free blocks of 2^(k + BUDDY_MIN_LOG2) bytes */
+    unsigned int map; /**< Bit k is set when free[k] is not empty */
+    unsigned int node; /**< NUMA node new chunks are placed on */
+    unsigned long purge_epoch; /**< Advanced by every buddy_purge(); free blocks are stamped with it */
+} buddy_bins;
+
+void *buddy_alloc(buddy_bins *bins, unsigned int owner, size_t size);
+void buddy_free(buddy_bins *bins, void *ptr);
+void buddy_purge(buddy_bins *bins);
+unsigned int buddy_owner(const void *ptr);
+size_t buddy_size(const void *ptr);
+int buddy_is_free(const void *ptr);
+void buddy_fork_lock(void);
+void buddy_fork_unlock(void);
+
+#endif //CYB3053_PROJECT2_BUDDY_H
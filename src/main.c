@@ -1,5 +1,6 @@
 #include "alloc.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 /**
@@ -175,6 +176,26 @@ int main(int argc, char** argv) {
     tufree(thing);
     tufree(other_thing);
 
+    // Check that requests too large to satisfy fail instead of wrapping around
+    if(tumalloc(SIZE_MAX) != NULL || tumalloc(SIZE_MAX - 8) != NULL || tu_memalign(64, SIZE_MAX - 8) != NULL) {
+        printf("Huge allocation did not fail\n");
+        return 1;
+    }
+
+    // Check that a trim pad larger than the free top of the heap releases nothing
+    tufree(tumalloc(4096));
+    tu_stats before_trim, after_trim;
+    tu_get_stats(&before_trim);
+    if(tu_trim(SIZE_MAX) != 0 || tu_trim(SIZE_MAX - 100) != 0) {
+        printf("Trim with a huge pad released memory\n");
+        return 1;
+    }
+    tu_get_stats(&after_trim);
+    if(after_trim.heap_bytes != before_trim.heap_bytes) {
+        printf("Trim with a huge pad shrank the heap\n");
+        return 1;
+    }
+
     // Create a new list
     HEAD = list_new(5);
 
@@ -242,6 +263,12 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // Check that growing far beyond what can be satisfied fails and leaves the block alone
+    if(turealloc(bigger_things, SIZE_MAX - 8) != NULL) {
+        printf("Huge reallocation did not fail\n");
+        return 1;
+    }
+
     // Set some values in the allocated memory
     for(int i=10; i<20; i++) {
         bigger_things[i] = i*10;
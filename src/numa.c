@@ -0,0 +1,144 @@
+#include "numa.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MPOL_PREFERRED 1 /**< From linux/mempolicy.h: take pages from the node while it has any */
+
+#define MASK_BITS (8 * sizeof(unsigned long)) /**< Node ids per word of an mbind() node mask */
+
+/**
+ * Number of online nodes, 1 until tu_numa_init() finds more. Placement is
+ * skipped while it is 1, so machines without NUMA pay nothing.
+ */
+static unsigned int node_count = 1;
+
+/**
+ * Kernel ids of the online nodes, which need not be contiguous (say "0,2").
+ * The rest of the allocator numbers nodes by their index in this list.
+ */
+static unsigned int node_ids[NUMA_MAX_NODES] = { 0 };
+
+/** Set when the kernel refuses mbind(), e.g. under a seccomp filter */
+static int bind_disabled = 0;
+
+/**
+ * List the online nodes from /sys/devices/system/node/online, a list like
+ * "0" or "0-1,3". Called once while the arenas are set up.
+ *
+ * This runs inside the first allocation, so it reads the file with plain
+ * system calls instead of stdio, which would allocate.
+ */
+void tu_numa_init(void) {
+    int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    char list[128];
+    ssize_t length = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (length <= 0) {
+        return;
+    }
+    list[length] = '\0';
+
+    unsigned int count = 0;
+    for (char *p = list; *p != '\0' && count < NUMA_MAX_NODES;) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p) {
+            p++;
+            continue;
+        }
+        unsigned long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+        }
+        for (unsigned long id = first; id <= last && id < NUMA_MAX_NODE_ID && count < NUMA_MAX_NODES; id++) {
+            node_ids[count++] = (unsigned int)id;
+        }
+        p = end;
+    }
+    if (count > 0) {
+        node_count = count;
+    }
+}
+
+/**
+ * Get the number of online nodes arenas are spread over
+ *
+ * @return At least 1
+ */
+unsigned int tu_numa_node_count(void) {
+    return node_count;
+}
+
+/**
+ * Get the kernel's id of a node
+ *
+ * @param node The node, below tu_numa_node_count()
+ * @return Its id, as in /sys/devices/system/node/node<id>
+ */
+unsigned int tu_numa_node_id(unsigned int node) {
+    return node_ids[node];
+}
+
+/**
+ * Get the node the calling thread runs on right now
+ *
+ * @return The node's index, 0 if the kernel does not say or there is only one
+ */
+unsigned int tu_numa_current_node(void) {
+    unsigned int cpu, id;
+    if (node_count == 1 || syscall(SYS_getcpu, &cpu, &id, NULL) != 0) {
+        return 0;
+    }
+    for (unsigned int node = 0; node < node_count; node++) {
+        if (node_ids[node] == id) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Ask the kernel to place the pages of a range on a node when they are
+ * first touched
+ *
+ * MPOL_PREFERRED rather than MPOL_BIND, so a full node spills over to the
+ * others instead of failing the allocation. Only whole pages inside the
+ * range are covered; pages already touched keep where they are. mbind()
+ * is called directly, so the allocator does not depend on libnuma.
+ *
+ * A node the kernel turns down (one without memory, say) just goes without
+ * placement; only a kernel that refuses mbind() altogether turns it off.
+ *
+ * @param start The start of the range
+ * @param size The size of the range
+ * @param node The index of the node to prefer
+ */
+void tu_numa_bind(void *start, size_t size, unsigned int node) {
+    if (node_count == 1 || __atomic_load_n(&bind_disabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)start + page - 1) & ~(page - 1);
+    uintptr_t last = ((uintptr_t)start + size) & ~(page - 1);
+    if (first >= last) {
+        return;
+    }
+
+    unsigned long mask[NUMA_MAX_NODE_ID / MASK_BITS] = { 0 };
+    unsigned int id = node_ids[node];
+    mask[id / MASK_BITS] = 1UL << (id % MASK_BITS);
+    if (syscall(SYS_mbind, first, last - first, MPOL_PREFERRED, mask, (unsigned long)NUMA_MAX_NODE_ID + 1, 0) != 0
+        && (errno == ENOSYS || errno == EPERM)) {
+        __atomic_store_n(&bind_disabled, 1, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef CYB3053_PROJECT2_NUMA_H
+#define CYB3053_PROJECT2_NUMA_H
+
+#include <stddef.h>
+
+#define NUMA_MAX_NODES 64 /**< Online nodes the allocator tells apart */
+#define NUMA_MAX_NODE_ID 1024 /**< Node ids at or above this are ignored */
+
+void tu_numa_init(void);
+unsigned int tu_numa_node_count(void);
+unsigned int tu_numa_node_id(unsigned int node);
+unsigned int tu_numa_current_node(void);
+void tu_numa_bind(void *start, size_t size, unsigned int node);
+
+#endif //CYB3053_PROJECT2_NUMA_H
@@ -0,0 +1,215 @@
+#include "alloc.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Drop-in replacement for the libc allocation functions, built as
+ * libtumalloc.so:
+ *
+ *     LD_PRELOAD=./libtumalloc.so program
+ *
+ * The library is built with -ftls-model=initial-exec, so the allocator's
+ * thread-local state lives in the static TLS block and reaching it never
+ * calls __tls_get_addr, which may itself allocate.
+ */
+
+#define BOOTSTRAP_SIZE (64 * 1024) /**< Bytes for allocations made from inside the allocator */
+#define BOOTSTRAP_ALIGN 16 /**< Alignment of bootstrap allocations, as for tumalloc */
+
+/**
+ * Nesting depth of the calling thread in the allocator. If anything the
+ * allocator calls (a libc function setting up thread-specific data, say)
+ * allocates in turn, the inner request is served from the bootstrap buffer
+ * instead of re-entering an arena whose lock the thread may hold.
+ */
+static __thread unsigned int depth = 0;
+
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(BOOTSTRAP_ALIGN)));
+static size_t bootstrap_used = 0;
+
+/**
+ * Carve a block off the bootstrap buffer. Bootstrap blocks are never
+ * reused; each starts with its size so realloc can copy it out.
+ *
+ * @param size The amount of memory to allocate
+ * @return The block, or NULL once the buffer is used up
+ */
+static void *bootstrap_alloc(size_t size) {
+    if (size > BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    size_t total = (BOOTSTRAP_ALIGN + size + BOOTSTRAP_ALIGN - 1) & ~(size_t)(BOOTSTRAP_ALIGN - 1);
+    size_t offset = __atomic_fetch_add(&bootstrap_used, total, __ATOMIC_RELAXED);
+    if (offset + total > BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    *(size_t *)(bootstrap + offset) = size;
+    return bootstrap + offset + BOOTSTRAP_ALIGN;
+}
+
+/**
+ * Tell whether a pointer came from bootstrap_alloc()
+ *
+ * @param ptr The pointer
+ * @return 1 if it did
+ */
+static int is_bootstrap(const void *ptr) {
+    return (const char *)ptr >= bootstrap && (const char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/**
+ * Get the size a bootstrap block was allocated with
+ *
+ * @param ptr The block
+ * @return Its size
+ */
+static size_t bootstrap_size(const void *ptr) {
+    return *(const size_t *)((const char *)ptr - BOOTSTRAP_ALIGN);
+}
+
+/**
+ * Set errno for a failed allocation and pass the result through
+ *
+ * @param ptr The allocation result
+ * @return ptr
+ */
+static void *check(void *ptr) {
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+/** malloc(3) on tumalloc */
+void *malloc(size_t size) {
+    if (depth > 0) {
+        return check(bootstrap_alloc(size));
+    }
+    depth++;
+    void *ptr = tumalloc(size);
+    depth--;
+    return check(ptr);
+}
+
+/** calloc(3) on tucalloc */
+void *calloc(size_t num, size_t size) {
+    if (depth > 0) {
+        size_t total;
+        if (__builtin_mul_overflow(num, size, &total)) {
+            return check(NULL);
+        }
+        return check(bootstrap_alloc(total)); // static memory is zero and never reused
+    }
+    depth++;
+    void *ptr = tucalloc(num, size);
+    depth--;
+    return check(ptr);
+}
+
+/** realloc(3) on turealloc; bootstrap blocks are copied out */
+void *realloc(void *ptr, size_t size) {
+    if (ptr != NULL && is_bootstrap(ptr)) {
+        void *moved = malloc(size);
+        if (moved != NULL) {
+            size_t old_size = bootstrap_size(ptr);
+            memcpy(moved, ptr, old_size < size ? old_size : size);
+        }
+        return moved;
+    }
+    if (depth > 0) {
+        return check(ptr == NULL ? bootstrap_alloc(size) : NULL);
+    }
+    depth++;
+    void *moved = turealloc(ptr, size);
+    depth--;
+    return size == 0 ? moved : check(moved);
+}
+
+/** free(3) on tufree; bootstrap blocks are left alone */
+void free(void *ptr) {
+    if (ptr == NULL || is_bootstrap(ptr)) {
+        return;
+    }
+    depth++;
+    tufree(ptr);
+    depth--;
+}
+
+/**
+ * Allocate aligned memory for the aligned entry points
+ *
+ * @param alignment The alignment, a power of two
+ * @param size The amount of memory to allocate
+ * @return The memory or NULL if out of memory
+ */
+static void *aligned(size_t alignment, size_t size) {
+    if (depth > 0) {
+        return alignment <= BOOTSTRAP_ALIGN ? bootstrap_alloc(size) : NULL;
+    }
+    depth++;
+    void *ptr = tu_memalign(alignment, size);
+    depth--;
+    return ptr;
+}
+
+/** posix_memalign(3): EINVAL unless alignment is a power-of-two multiple of sizeof(void *) */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = aligned(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/** aligned_alloc(3) */
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return check(aligned(alignment, size));
+}
+
+/** memalign(3) */
+void *memalign(size_t alignment, size_t size) {
+    // Like glibc, round an alignment that is not a power of two up to one.
+    size_t power = BOOTSTRAP_ALIGN;
+    while (power < alignment) {
+        if (power > SIZE_MAX / 2) {
+            errno = EINVAL;
+            return NULL;
+        }
+        power *= 2;
+    }
+    return check(aligned(power, size));
+}
+
+/** valloc(3): page-aligned memory */
+void *valloc(size_t size) {
+    return check(aligned((size_t)sysconf(_SC_PAGESIZE), size));
+}
+
+/** pvalloc(3): page-aligned memory, rounded up to whole pages */
+void *pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return check(aligned(page, (size + page - 1) & ~(page - 1)));
+}
+
+/** malloc_usable_size(3) on tu_usable_size */
+size_t malloc_usable_size(void *ptr) {
+    if (ptr != NULL && is_bootstrap(ptr)) {
+        return bootstrap_size(ptr);
+    }
+    return tu_usable_size(ptr);
+}
@@ -0,0 +1,138 @@
+#include "radix.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define RADIX_PAGE_SHIFT 12 /**< The tree maps 4 KiB pages */
+#define RADIX_BITS 12 /**< Page number bits consumed per level */
+#define RADIX_FANOUT (1 << RADIX_BITS) /**< Entries per node */
+#define RADIX_KEY_BITS (3 * RADIX_BITS) /**< Page number bits covered: 48-bit addresses */
+
+/**
+ * Last level: one span pointer per page
+ */
+typedef struct radix_leaf {
+    span *entries[RADIX_FANOUT];
+} radix_leaf;
+
+/**
+ * Middle level: one leaf per 16 MiB of address space
+ */
+typedef struct radix_mid {
+    radix_leaf *leaves[RADIX_FANOUT];
+} radix_mid;
+
+/**
+ * Three-level radix tree keyed by page number. Lookups take no lock: nodes
+ * are never freed, and they and their entries are published with release
+ * stores. Writers serialize on radix_lock only to create nodes.
+ */
+static radix_mid *root[RADIX_FANOUT];
+static pthread_mutex_t radix_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Get a zeroed node straight from the OS
+ *
+ * @param size The size of the node
+ * @return The node or NULL if out of memory
+ */
+static void *node_alloc(size_t size) {
+    void *node = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return node == MAP_FAILED ? NULL : node;
+}
+
+/**
+ * Find the leaf covering a page, creating the path to it if asked to
+ *
+ * @param key The page number
+ * @param create Whether missing nodes should be created
+ * @return The leaf or NULL
+ */
+static radix_leaf *leaf_for(uintptr_t key, int create) {
+    uintptr_t i1 = key >> (2 * RADIX_BITS);
+    uintptr_t i2 = (key >> RADIX_BITS) & (RADIX_FANOUT - 1);
+
+    radix_mid *mid = __atomic_load_n(&root[i1], __ATOMIC_ACQUIRE);
+    radix_leaf *leaf = mid ? __atomic_load_n(&mid->leaves[i2], __ATOMIC_ACQUIRE) : NULL;
+    if (leaf != NULL || !create) {
+        return leaf;
+    }
+
+    pthread_mutex_lock(&radix_lock);
+    mid = root[i1];
+    if (mid == NULL) {
+        mid = node_alloc(sizeof(radix_mid));
+        if (mid != NULL) {
+            __atomic_store_n(&root[i1], mid, __ATOMIC_RELEASE);
+        }
+    }
+    if (mid != NULL) {
+        leaf = mid->leaves[i2];
+        if (leaf == NULL) {
+            leaf = node_alloc(sizeof(radix_leaf));
+            if (leaf != NULL) {
+                __atomic_store_n(&mid->leaves[i2], leaf, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    pthread_mutex_unlock(&radix_lock);
+    return leaf;
+}
+
+/**
+ * Map every page overlapping [start, start + size) to a span
+ *
+ * @param start The first byte of the range
+ * @param size The length of the range
+ * @param s The span, or NULL to forget the range
+ * @return 0 on success, -1 if a node could not be allocated or the range
+ *         is outside the addresses the tree covers
+ */
+int radix_set(const void *start, size_t size, span *s) {
+    uintptr_t first = (uintptr_t)start >> RADIX_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t)start + size - 1) >> RADIX_PAGE_SHIFT;
+
+    if (size == 0 || last >> RADIX_KEY_BITS) {
+        return -1;
+    }
+
+    for (uintptr_t key = first; key <= last; key++) {
+        radix_leaf *leaf = leaf_for(key, s != NULL);
+        if (leaf == NULL) {
+            if (s != NULL) {
+                return -1;
+            }
+            key |= RADIX_FANOUT - 1; // nothing mapped in this leaf's range
+            continue;
+        }
+        __atomic_store_n(&leaf->entries[key & (RADIX_FANOUT - 1)], s, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/**
+ * Find the span of the page a pointer lies in
+ *
+ * @param ptr Any pointer
+ * @return The span, or NULL if the allocator never handed out that page
+ */
+span *radix_lookup(const void *ptr) {
+    uintptr_t key = (uintptr_t)ptr >> RADIX_PAGE_SHIFT;
+    if (key >> RADIX_KEY_BITS) {
+        return NULL;
+    }
+
+    radix_leaf *leaf = leaf_for(key, 0);
+    return leaf ? __atomic_load_n(&leaf->entries[key & (RADIX_FANOUT - 1)], __ATOMIC_ACQUIRE) : NULL;
+}
+
+/** Keep other threads from adding nodes while fork() copies the tree */
+void radix_fork_lock(void) {
+    pthread_mutex_lock(&radix_lock);
+}
+
+/** Release the lock taken by radix_fork_lock(), in the parent or the child */
+void radix_fork_unlock(void) {
+    pthread_mutex_unlock(&radix_lock);
+}
@@ -0,0 +1,30 @@
+#ifndef CYB3053_PROJECT2_RADIX_H
+#define CYB3053_PROJECT2_RADIX_H
+
+#include <stddef.h>
+
+/**
+ * What kind of memory a page handed out by the allocator holds
+ */
+typedef enum span_kind {
+    SPAN_HEAP = 1, /**< Arena chunks: blocks with headers and boundary tags */
+    SPAN_SLAB, /**< A slab of headerless slots */
+    SPAN_LARGE, /**< One large block in its own mapping */
+    SPAN_BUDDY, /**< A chunk of headerless power-of-two blocks */
+} span_kind;
+
+/**
+ * Metadata the radix tree maps pages to. Slabs and buddy chunks embed one
+ * as their first member; heap chunks and large mappings share one static span per kind,
+ * since their blocks carry headers.
+ */
+typedef struct span {
+    span_kind kind; /**< What the pages hold */
+} span;
+
+int radix_set(const void *start, size_t size, span *s);
+span *radix_lookup(const void *ptr);
+void radix_fork_lock(void);
+void radix_fork_unlock(void);
+
+#endif //CYB3053_PROJECT2_RADIX_H
@@ -0,0 +1,206 @@
+#include "region.h"
+#include "numa.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** Regions reserved so far, for region_huge_bytes() */
+static region *regions = NULL;
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Get the step in which regions commit and release memory
+ *
+ * @return HUGE_PAGE_SIZE with TU_HUGEPAGES, the page size otherwise
+ */
+size_t region_granule(void) {
+#ifdef TU_HUGEPAGES
+    return HUGE_PAGE_SIZE;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/**
+ * Reserve the address range. The region lock must be held.
+ *
+ * Over-reserves by the alignment and gives the unaligned slack back, so
+ * base ends up aligned.
+ *
+ * @param r The region to reserve
+ * @param node The NUMA node to bind the whole range to
+ * @return 0 on success, -1 if the range could not be reserved
+ */
+static int region_reserve(region *r, unsigned int node) {
+#ifdef TU_HUGEPAGES
+    if (r->align < HUGE_PAGE_SIZE) {
+        r->align = HUGE_PAGE_SIZE;
+    }
+#endif
+    size_t slack = r->align > (size_t)sysconf(_SC_PAGESIZE) ? r->align : 0;
+    char *map = mmap(NULL, r->size + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    char *base = (char *)(((uintptr_t)map + slack) & ~(uintptr_t)(slack ? slack - 1 : 0));
+    if (slack) {
+        if (base > map) {
+            munmap(map, base - map);
+        }
+        munmap(base + r->size, map + slack - base);
+    }
+
+#ifdef TU_HUGEPAGES
+    // The flag sticks to the range when mprotect() later splits it up;
+    // region_trim() has to set it again on the mappings it replaces.
+    madvise(base, r->size, MADV_HUGEPAGE);
+#endif
+    // One policy for the whole range: binding pieces of it separately would
+    // leave a mapping per piece, and enough of those exhaust vm.max_map_count.
+    tu_numa_bind(base, r->size, node);
+
+    r->node = node;
+    r->base = base;
+    r->brk = base;
+    r->committed = base;
+
+    pthread_mutex_lock(&regions_lock);
+    r->next_region = regions;
+    regions = r;
+    pthread_mutex_unlock(&regions_lock);
+    return 0;
+}
+
+/**
+ * Move the region's break up, committing pages as needed
+ *
+ * @param r The region to grow
+ * @param size How many bytes to hand out (a multiple of 16)
+ * @param node The NUMA node to bind the region to if this reserves it
+ * @return The start of the new memory, or NULL if the region is exhausted
+ */
+void *region_grow(region *r, size_t size, unsigned int node) {
+    pthread_mutex_lock(&r->lock);
+    if (r->base == NULL && region_reserve(r, node) != 0) {
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+    }
+
+    if (size > (size_t)(r->base + r->size - r->brk)) {
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+    }
+
+    char *start = r->brk;
+    char *end = start + size;
+    if (end > r->committed) {
+        size_t page = region_granule();
+        char *commit_end = (char *)(((uintptr_t)end + page - 1) & ~(uintptr_t)(page - 1));
+        if (mprotect(r->committed, commit_end - r->committed, PROT_READ | PROT_WRITE) != 0) {
+            pthread_mutex_unlock(&r->lock);
+            return NULL;
+        }
+        r->committed = commit_end;
+    }
+    r->brk = end;
+    pthread_mutex_unlock(&r->lock);
+
+    return start;
+}
+
+/**
+ * Move the region's break down to end and give the pages above it back to
+ * the OS, but only if the break is still at top, i.e. nobody has grown the
+ * region since the caller looked at it
+ *
+ * The pages are replaced by fresh PROT_NONE ones rather than just
+ * protected, so they read as zero again when they are committed next.
+ * Only whole commit granules (see region_granule()) are released.
+ *
+ * @param r The region to trim
+ * @param top Where the caller expects the break to be
+ * @param end The new break, below top
+ * @return 0 on success, -1 if the break has moved or the pages could not be released
+ */
+int region_trim(region *r, char *top, char *end) {
+    pthread_mutex_lock(&r->lock);
+    if (r->brk != top) {
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+
+    size_t page = region_granule();
+    char *keep = (char *)(((uintptr_t)end + page - 1) & ~(uintptr_t)(page - 1));
+    if (keep < r->committed) {
+        void *map = mmap(keep, r->committed - keep, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        if (map == MAP_FAILED) {
+            pthread_mutex_unlock(&r->lock);
+            return -1;
+        }
+#ifdef TU_HUGEPAGES
+        // The fresh mapping does not inherit the advice from region_reserve().
+        madvise(keep, r->committed - keep, MADV_HUGEPAGE);
+#endif
+        // Nor the node binding, without which it would not merge with the rest.
+        tu_numa_bind(keep, r->committed - keep, r->node);
+        r->committed = keep;
+    }
+    r->brk = end;
+    pthread_mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+/**
+ * Count how much of the reserved regions is backed by transparent huge
+ * pages right now, from the AnonHugePages lines of /proc/self/smaps
+ *
+ * @return Bytes in huge pages, 0 if smaps cannot be read
+ */
+size_t region_huge_bytes(void) {
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) {
+        return 0;
+    }
+
+    size_t total = 0;
+    int inside = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long start, end, kib;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            // A mapping header; the lines up to the next one describe it.
+            inside = 0;
+            pthread_mutex_lock(&regions_lock);
+            for (region *r = regions; r != NULL; r = r->next_region) {
+                if (start >= (uintptr_t)r->base && end <= (uintptr_t)(r->base + r->size)) {
+                    inside = 1;
+                }
+            }
+            pthread_mutex_unlock(&regions_lock);
+        }
+        else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+            total += (size_t)kib * 1024;
+        }
+    }
+    fclose(smaps);
+
+    return total;
+}
+
+/**
+ * Take the lock of the region list before fork(). Region locks nest
+ * outside it, so callers take those first.
+ */
+void region_fork_lock(void) {
+    pthread_mutex_lock(&regions_lock);
+}
+
+/** Release the lock taken by region_fork_lock(), in the parent or the child */
+void region_fork_unlock(void) {
+    pthread_mutex_unlock(&regions_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef CYB3053_PROJECT2_REGION_H
+#define CYB3053_PROJECT2_REGION_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20) /**< Size of a transparent huge page (x86-64) */
+
+/**
+ * A virtual range reserved with PROT_NONE when it is first needed. Memory
+ * is handed out from the bottom like a program break, and pages are made
+ * accessible only as the break moves over them, so the allocator never
+ * touches the real program break that libc malloc uses.
+ *
+ * A region is bound to one NUMA node as a whole when it is reserved, so
+ * its pages share one memory policy and the mappings mprotect() splits
+ * off as it grows merge back into a single one. Allocators keep one region
+ * per node for that reason.
+ *
+ * With TU_HUGEPAGES every region is aligned to HUGE_PAGE_SIZE, marked
+ * MADV_HUGEPAGE and committed in whole huge pages, so the kernel can back
+ * it with transparent huge pages as soon as it is touched.
+ */
+typedef struct region {
+    char *base; /**< Start of the reservation, NULL until first use */
+    char *brk; /**< End of the memory handed out so far */
+    char *committed; /**< End of the accessible pages */
+    size_t size; /**< Bytes to reserve */
+    size_t align; /**< Alignment of base, a power of two */
+    unsigned int node; /**< NUMA node the reservation is bound to */
+    pthread_mutex_t lock; /**< Protects everything above */
+    struct region *next_region; /**< Next reserved region, for region_huge_bytes() */
+} region;
+
+/** Static initializer for a region of size bytes whose base is aligned to align */
+#define REGION_INITIALIZER(size, align) { NULL, NULL, NULL, (size), (align), 0, PTHREAD_MUTEX_INITIALIZER, NULL }
+
+void *region_grow(region *r, size_t size, unsigned int node);
+int region_trim(region *r, char *top, char *end);
+size_t region_granule(void);
+size_t region_huge_bytes(void);
+void region_fork_lock(void);
+void region_fork_unlock(void);
+
+#endif //CYB3053_PROJECT2_REGION_H
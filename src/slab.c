@@ -0,0 +1,246 @@
+#include "slab.h"
+#include "numa.h"
+#include "radix.h"
+#include "region.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#ifndef SLAB_REGION_SIZE
+#define SLAB_REGION_SIZE ((size_t)16 << 30) /**< Address space reserved for slabs */
+#endif
+
+#define SLAB_HEADER_SIZE ((sizeof(slab) + 15) & ~(size_t)15) /**< Bytes before the first slot */
+#define SLAB_PURGED (~0UL) /**< Purge stamp of an empty slab whose pages have been released */
+
+/**
+ * A SLAB_SIZE-aligned run of pages carved into equal-sized slots. The slab
+ * header sits at the start, so the slab of any slot is found by masking, and
+ * it records the size class once for all slots, which carry no header.
+ */
+typedef struct slab {
+    span span; /**< What the radix tree maps the slab's pages to */
+    struct slab *next; /**< Next slab in the partial or empty list */
+    struct slab *prev; /**< Previous slab in the partial list */
+    unsigned int owner; /**< Arena the slab belongs to */
+    int cls; /**< Size class, or -1 while the slab is empty */
+    size_t slot_size; /**< Bytes per slot */
+    unsigned int capacity; /**< Number of slots */
+    unsigned int used; /**< Number of slots handed out */
+    char *bump; /**< First slot that has never been handed out */
+    void *free_list; /**< Intrusive list of returned slots */
+    unsigned long purge_stamp; /**< While empty: purge_epoch when it became empty, or SLAB_PURGED */
+} slab;
+
+/** Slabs get their own aligned range per node, so their pages never mix with heap chunks */
+static region slab_regions[NUMA_MAX_NODES] = {
+    [0 ... NUMA_MAX_NODES - 1] = REGION_INITIALIZER(SLAB_REGION_SIZE, SLAB_SIZE)
+};
+
+/**
+ * Find the slab a slot lives in
+ *
+ * @param ptr Any pointer into the slab
+ * @return The slab header
+ */
+static slab *slab_of(const void *ptr) {
+    return (slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+/**
+ * Unlink a slab from the partial list of its class
+ *
+ * @param bins The slab lists of the owning arena
+ * @param s The slab to unlink
+ */
+static void partial_remove(slab_bins *bins, slab *s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    }
+    else {
+        bins->partial[s->cls] = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+}
+
+/**
+ * Push a slab onto the partial list of its class
+ *
+ * @param bins The slab lists of the owning arena
+ * @param s The slab to push
+ */
+static void partial_push(slab_bins *bins, slab *s) {
+    s->prev = NULL;
+    s->next = bins->partial[s->cls];
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    bins->partial[s->cls] = s;
+}
+
+/**
+ * Get a slab for a class, reusing an empty one when possible
+ *
+ * @param bins The slab lists of the owning arena
+ * @param owner Index of the owning arena
+ * @param cls The size class
+ * @param slot_size Bytes per slot
+ * @return The slab, already on the partial list, or NULL if out of memory
+ */
+static slab *slab_new(slab_bins *bins, unsigned int owner, int cls, size_t slot_size) {
+    slab *s = bins->empty;
+    if (s != NULL) {
+        bins->empty = s->next;
+    }
+    else {
+        s = region_grow(&slab_regions[bins->node], SLAB_SIZE, bins->node);
+        if (s == NULL) {
+            return NULL;
+        }
+        s->span.kind = SPAN_SLAB;
+        if (radix_set(s, SLAB_SIZE, &s->span) != 0) {
+            return NULL;
+        }
+    }
+
+    s->owner = owner;
+    s->cls = cls;
+    s->slot_size = slot_size;
+    s->capacity = (unsigned int)((SLAB_SIZE - SLAB_HEADER_SIZE) / slot_size);
+    s->used = 0;
+    s->bump = (char *)s + SLAB_HEADER_SIZE;
+    s->free_list = NULL;
+    partial_push(bins, s);
+    return s;
+}
+
+/**
+ * Hand out one slot of a size class. The owning arena's lock must be held.
+ *
+ * @param bins The slab lists of the arena
+ * @param owner Index of the arena
+ * @param cls The size class
+ * @param slot_size Bytes per slot for this class
+ * @return The slot or NULL if out of memory
+ */
+void *slab_alloc(slab_bins *bins, unsigned int owner, int cls, size_t slot_size) {
+    slab *s = bins->partial[cls];
+    if (s == NULL) {
+        s = slab_new(bins, owner, cls, slot_size);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+
+    void *slot = s->free_list;
+    if (slot != NULL) {
+        s->free_list = *(void **)slot;
+    }
+    else {
+        slot = s->bump;
+        s->bump += s->slot_size;
+    }
+
+    if (++s->used == s->capacity) {
+        partial_remove(bins, s); // full slabs are on no list
+    }
+    return slot;
+}
+
+/**
+ * Return a slot to its slab. The owning arena's lock must be held.
+ *
+ * @param bins The slab lists of the arena that owns the slab
+ * @param slot The slot to return
+ */
+void slab_free(slab_bins *bins, void *slot) {
+    slab *s = slab_of(slot);
+
+    *(void **)slot = s->free_list;
+    s->free_list = slot;
+
+    if (s->used-- == s->capacity) {
+        partial_push(bins, s);
+    }
+    if (s->used == 0) {
+        partial_remove(bins, s);
+        s->cls = -1;
+        s->purge_stamp = bins->purge_epoch;
+        s->next = bins->empty;
+        bins->empty = s;
+    }
+}
+
+/**
+ * Release the pages of the slabs that have been empty since before the
+ * previous call, and start a new epoch. The owning arena's lock must be
+ * held.
+ *
+ * The first page, holding the slab header, stays; the rest reads as zero
+ * when the slab is reused. Only whole commit granules are released (see
+ * region_granule()), so with TU_HUGEPAGES, whose granule is larger than a
+ * slab, empty slabs are kept resident.
+ *
+ * @param bins The slab lists of the arena
+ */
+void slab_purge(slab_bins *bins) {
+    uintptr_t page = region_granule();
+    for (slab *s = bins->empty; s != NULL; s = s->next) {
+        if (s->purge_stamp == SLAB_PURGED || s->purge_stamp >= bins->purge_epoch) {
+            continue;
+        }
+        uintptr_t start = ((uintptr_t)s + SLAB_HEADER_SIZE + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)s + SLAB_SIZE) & ~(page - 1);
+        if (start < end) {
+            madvise((void *)start, end - start, MADV_DONTNEED);
+        }
+        s->purge_stamp = SLAB_PURGED;
+    }
+    bins->purge_epoch++;
+}
+
+/**
+ * Get the arena that owns the slab of a slot
+ *
+ * @param slot The slot
+ * @return Index of the owning arena
+ */
+unsigned int slab_owner(const void *slot) {
+    return slab_of(slot)->owner;
+}
+
+/**
+ * Get the size class of a slot, checking that the pointer really is the
+ * start of a slot that has been handed out
+ *
+ * @param slot The pointer to look up
+ * @return The size class, or -1 if slot is not a valid slot
+ */
+int slab_class(const void *slot) {
+    slab *s = slab_of(slot);
+    const char *first = (const char *)s + SLAB_HEADER_SIZE;
+
+    if (s->cls < 0 || (const char *)slot < first || (const char *)slot >= s->bump) {
+        return -1;
+    }
+    if ((size_t)((const char *)slot - first) % s->slot_size != 0) {
+        return -1;
+    }
+    return s->cls;
+}
+
+/** Keep other threads from carving slabs while fork() copies the region */
+void slab_fork_lock(void) {
+    for (unsigned int node = 0; node < NUMA_MAX_NODES; node++) {
+        pthread_mutex_lock(&slab_regions[node].lock);
+    }
+}
+
+/** Release the lock taken by slab_fork_lock(), in the parent or the child */
+void slab_fork_unlock(void) {
+    for (unsigned int node = NUMA_MAX_NODES; node-- > 0;) {
+        pthread_mutex_unlock(&slab_regions[node].lock);
+    }
+}
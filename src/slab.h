@@ -0,0 +1,29 @@
+#ifndef CYB3053_PROJECT2_SLAB_H
+#define CYB3053_PROJECT2_SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_SIZE (64 * 1024) /**< Bytes per slab, slabs are aligned to this */
+#define SLAB_CLASSES 32 /**< Number of slot sizes a slab_bins keeps lists for */
+
+struct slab;
+
+/**
+ * The slabs one arena carves small objects from
+ */
+typedef struct slab_bins {
+    struct slab *partial[SLAB_CLASSES]; /**< Slabs with free slots, per class */
+    struct slab *empty; /**< Completely free slabs, reusable by any class */
+    unsigned int node; /**< NUMA node new slabs are placed on */
+    unsigned long purge_epoch; /**< Advanced by every slab_purge(); empty slabs are stamped with it */
+} slab_bins;
+
+void *slab_alloc(slab_bins *bins, unsigned int owner, int cls, size_t slot_size);
+void slab_free(slab_bins *bins, void *slot);
+void slab_purge(slab_bins *bins);
+unsigned int slab_owner(const void *slot);
+int slab_class(const void *slot);
+void slab_fork_lock(void);
+void slab_fork_unlock(void);
+
+#endif //CYB3053_PROJECT2_SLAB_H
@@ -0,0 +1,96 @@
+#include "alloc.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifdef TU_TRACE
+
+#define TRACE_ENTRIES 4096 /**< Size of the ring buffer, must be a power of two */
+
+/**
+ * One recorded event. seq is written last, so a reader can tell whether
+ * the slot holds a complete entry of the lap it expects.
+ */
+typedef struct trace_entry {
+    _Atomic unsigned long seq; /**< Sequence number + 1 of the event in this slot */
+    trace_event event; /**< What happened */
+    const void *addr; /**< Block involved */
+    size_t size; /**< Size involved */
+} trace_entry;
+
+static trace_entry ring[TRACE_ENTRIES];
+static _Atomic unsigned long ring_next = 0; /**< Sequence number of the next event */
+
+static const char *event_names[] = {
+    [TRACE_CHECK] = "check",
+    [TRACE_FOUND] = "found",
+    [TRACE_SPLIT] = "split",
+    [TRACE_ALLOC] = "alloc",
+    [TRACE_FREE] = "free",
+};
+
+/**
+ * Record an event in the ring buffer without taking any lock
+ *
+ * @param event What happened
+ * @param addr The block involved
+ * @param size The size involved
+ */
+void trace_record(trace_event event, const void *addr, size_t size) {
+    unsigned long seq = atomic_fetch_add_explicit(&ring_next, 1, memory_order_relaxed);
+    trace_entry *entry = &ring[seq & (TRACE_ENTRIES - 1)];
+
+    atomic_store_explicit(&entry->seq, 0, memory_order_relaxed);
+    entry->event = event;
+    entry->addr = addr;
+    entry->size = size;
+    atomic_store_explicit(&entry->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Write the buffered events, oldest first, to a file descriptor
+ *
+ * Uses write() directly so dumping never allocates through stdio.
+ *
+ * @param fd The file descriptor to write to
+ */
+void tu_trace_dump(int fd) {
+    unsigned long end = atomic_load_explicit(&ring_next, memory_order_acquire);
+    unsigned long start = end > TRACE_ENTRIES ? end - TRACE_ENTRIES : 0;
+    char line[128];
+
+    for (unsigned long seq = start; seq < end; seq++) {
+        trace_entry *entry = &ring[seq & (TRACE_ENTRIES - 1)];
+        if (atomic_load_explicit(&entry->seq, memory_order_acquire) != seq + 1) {
+            continue; // overwritten or still being written
+        }
+        trace_event event = entry->event;
+        const void *addr = entry->addr;
+        size_t size = entry->size;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&entry->seq, memory_order_relaxed) != seq + 1) {
+            continue; // a writer lapped us while copying
+        }
+
+        int len = snprintf(line, sizeof(line), "%lu %s %p %zu\n",
+                           seq, event_names[event], addr, size);
+        if (write(fd, line, len) < 0) {
+            return;
+        }
+    }
+}
+
+#else
+
+/**
+ * Tracing is compiled out, so there is nothing to dump
+ *
+ * @param fd The file descriptor that would have been written to
+ */
+void tu_trace_dump(int fd) {
+    (void)fd;
+}
+
+#endif
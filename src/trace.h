@@ -0,0 +1,26 @@
+#ifndef CYB3053_PROJECT2_TRACE_H
+#define CYB3053_PROJECT2_TRACE_H
+
+#include <stddef.h>
+
+/**
+ * Allocator events that can be recorded in the trace ring buffer
+ */
+typedef enum trace_event {
+    TRACE_CHECK, /**< A free block was checked against a request */
+    TRACE_FOUND, /**< A suitable free block was found */
+    TRACE_SPLIT, /**< A block was split, size is the remainder */
+    TRACE_ALLOC, /**< A block was handed out */
+    TRACE_FREE, /**< A block was returned */
+} trace_event;
+
+#ifdef TU_TRACE
+void trace_record(trace_event event, const void *addr, size_t size);
+
+/** Record an event; compiles to nothing unless TU_TRACE is defined */
+#define TRACE(event, addr, size) trace_record((event), (addr), (size))
+#else
+#define TRACE(event, addr, size) ((void)0)
+#endif
+
+#endif //CYB3053_PROJECT2_TRACE_H
@@ -0,0 +1,213 @@
+#include "tree.h"
+
+#include <stdint.h>
+
+/**
+ * Treap priority of a node. It is a hash of the node's address, so it
+ * costs no space and stays the same for as long as the node is in a tree;
+ * ordering the tree as a heap on it keeps the expected depth O(log n).
+ *
+ * @param node The node
+ * @return The priority
+ */
+static uint32_t priority(const tree_node *node) {
+    return (uint32_t)(((uintptr_t)node * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/**
+ * Check whether one node comes before another in tree order
+ *
+ * @param a The first node
+ * @param b The second node
+ * @return Whether a's key is smaller than b's
+ */
+static int before(const tree_node *a, const tree_node *b) {
+#ifdef TU_POLICY_ADDRFIT
+    return (uintptr_t)a < (uintptr_t)b;
+#else
+    return a->size < b->size || (a->size == b->size && (uintptr_t)a < (uintptr_t)b);
+#endif
+}
+
+/**
+ * Recompute the largest size in a subtree from its children
+ *
+ * @param node The root of the subtree
+ * @return node
+ */
+static tree_node *update(tree_node *node) {
+    size_t max = node->size;
+    if (node->left != NULL && node->left->max > max) {
+        max = node->left->max;
+    }
+    if (node->right != NULL && node->right->max > max) {
+        max = node->right->max;
+    }
+    node->max = max;
+    return node;
+}
+
+/**
+ * Insert a node below a subtree root, rotating it up past any ancestor of
+ * lower priority
+ *
+ * @param root The subtree
+ * @param node The node to insert
+ * @return The new subtree root
+ */
+static tree_node *insert_at(tree_node *root, tree_node *node) {
+    if (root == NULL) {
+        return node;
+    }
+
+    if (before(node, root)) {
+        root->left = insert_at(root->left, node);
+        if (priority(root->left) > priority(root)) {
+            tree_node *up = root->left;
+            root->left = up->right;
+            up->right = update(root);
+            return update(up);
+        }
+    }
+    else {
+        root->right = insert_at(root->right, node);
+        if (priority(root->right) > priority(root)) {
+            tree_node *up = root->right;
+            root->right = up->left;
+            up->left = update(root);
+            return update(up);
+        }
+    }
+    return update(root);
+}
+
+/**
+ * Join two subtrees where every key of the first is smaller than every key
+ * of the second
+ *
+ * @param left The subtree of smaller keys
+ * @param right The subtree of larger keys
+ * @return The joined subtree
+ */
+static tree_node *join(tree_node *left, tree_node *right) {
+    if (left == NULL) {
+        return right;
+    }
+    if (right == NULL) {
+        return left;
+    }
+    if (priority(left) > priority(right)) {
+        left->right = join(left->right, right);
+        return update(left);
+    }
+    right->left = join(left, right->left);
+    return update(right);
+}
+
+/**
+ * Remove a node from a subtree that contains it
+ *
+ * @param root The subtree
+ * @param node The node to remove
+ * @return The new subtree root
+ */
+static tree_node *remove_at(tree_node *root, tree_node *node) {
+    if (root == node) {
+        return join(node->left, node->right);
+    }
+    if (before(node, root)) {
+        root->left = remove_at(root->left, node);
+    }
+    else {
+        root->right = remove_at(root->right, node);
+    }
+    return update(root);
+}
+
+/**
+ * Add a free block to a tree
+ *
+ * @param root The tree
+ * @param node The node in the block's payload
+ * @param size The size of the block
+ */
+void tree_insert(tree_node **root, tree_node *node, size_t size) {
+    node->left = NULL;
+    node->right = NULL;
+    node->size = size;
+    node->max = size;
+    *root = insert_at(*root, node);
+}
+
+/**
+ * Take a free block out of the tree it is in
+ *
+ * @param root The tree
+ * @param node The node of the block
+ */
+void tree_remove(tree_node **root, tree_node *node) {
+    *root = remove_at(*root, node);
+}
+
+#ifdef TU_POLICY_ADDRFIT
+/**
+ * Find the lowest-addressed block that holds a request in O(log n)
+ *
+ * The largest size of each subtree says whether a fit can be in it at all,
+ * so the walk goes left whenever the lower addresses have one and never
+ * backtracks. Preferring low addresses leaves the top of the heap free.
+ *
+ * @param root The tree
+ * @param size The requested size
+ * @param slack Unused, address order takes the first fit
+ * @return The node of the block (still in the tree) or NULL if none is large enough
+ */
+tree_node *tree_fit(tree_node *root, size_t size, size_t slack) {
+    (void)slack;
+
+    if (root == NULL || root->max < size) {
+        return NULL;
+    }
+    for (;;) {
+        if (root->left != NULL && root->left->max >= size) {
+            root = root->left;
+        }
+        else if (root->size >= size) {
+            return root;
+        }
+        else {
+            root = root->right;
+        }
+    }
+}
+#else
+/**
+ * Find a block for a request in O(log n)
+ *
+ * With no slack this is best fit: the smallest block that holds size bytes,
+ * lowest address first. Good fit stops at the first block on the way down
+ * that wastes at most slack bytes, trading a little fragmentation for a
+ * shorter search.
+ *
+ * @param root The tree
+ * @param size The requested size
+ * @param slack How many bytes more than size a block may have to be taken at once
+ * @return The node of the block (still in the tree) or NULL if none is large enough
+ */
+tree_node *tree_fit(tree_node *root, size_t size, size_t slack) {
+    tree_node *best = NULL;
+
+    while (root != NULL) {
+        if (root->size < size) {
+            root = root->right;
+            continue;
+        }
+        best = root;
+        if (root->size - size <= slack && slack != 0) {
+            break;
+        }
+        root = root->left;
+    }
+    return best;
+}
+#endif
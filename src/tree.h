@@ -0,0 +1,23 @@
+#ifndef CYB3053_PROJECT2_TREE_H
+#define CYB3053_PROJECT2_TREE_H
+
+#include <stddef.h>
+
+/**
+ * Intrusive node of the free block tree, stored in the payload of a free
+ * block. Nodes are ordered by size and then by address, so equal sizes
+ * are handed out lowest address first; with TU_POLICY_ADDRFIT they are
+ * ordered by address alone.
+ */
+typedef struct tree_node {
+    struct tree_node *left; /**< Subtree of smaller keys */
+    struct tree_node *right; /**< Subtree of larger keys */
+    size_t size; /**< Size of the free block */
+    size_t max; /**< Largest size in this subtree */
+} tree_node;
+
+void tree_insert(tree_node **root, tree_node *node, size_t size);
+void tree_remove(tree_node **root, tree_node *node);
+tree_node *tree_fit(tree_node *root, size_t size, size_t slack);
+
+#endif //CYB3053_PROJECT2_TREE_H